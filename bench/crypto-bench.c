@@ -0,0 +1,276 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Micro-benchmarks for the building blocks of scrypt and of the scrypt file
+ * format.  This file includes crypto_scrypt-nosse.c so that it can call the
+ * static salsa20_8, blockmix_salsa8 and smix functions directly; build it
+ * with "python setup.py build_bench", which uses the same sources, include
+ * paths and macros as the extension, and run build/crypto-bench.
+ *
+ * The results are written to standard output as a JSON array with one
+ * object per benchmark, giving the bytes processed per call, the number of
+ * calls per second, and, on x86, the number of TSC cycles per byte.
+ */
+
+#include "crypto_scrypt-nosse.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <openssl/aes.h>
+
+#include "crypto_aesctr.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+/* Minimum running time of each benchmark, in seconds. */
+static double mintime = 0.2;
+
+/* Set to a comma when a result has been printed. */
+static const char * sep = "";
+
+/* Buffers shared by the benchmarks. */
+static uint8_t * bufin;
+static uint8_t * bufout;
+static uint32_t * V;
+static uint32_t * XY;
+
+#define BUFSIZE (1 << 20)
+
+/* The function being measured and its parameters. */
+struct bench {
+	const char * name;
+	void (* fn)(struct bench *);
+	size_t bytes;
+	uint64_t N;
+	size_t r;
+	AES_KEY * key;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec * 0.000000001);
+}
+
+static uint64_t
+cycles(void)
+{
+
+#ifdef HAVE_RDTSC
+	return (__rdtsc());
+#else
+	return (0);
+#endif
+}
+
+/**
+ * run(b, params):
+ * Call b->fn until mintime has passed, doubling the number of calls each
+ * round, and print the result with the JSON object members params.
+ */
+static void
+run(struct bench * b, const char * params)
+{
+	uint64_t calls = 1;
+	uint64_t i;
+	uint64_t c0, c1;
+	double t0, t1;
+
+	do {
+		calls *= 2;
+		t0 = now();
+		c0 = cycles();
+		for (i = 0; i < calls; i++)
+			b->fn(b);
+		c1 = cycles();
+		t1 = now();
+	} while (t1 - t0 < mintime);
+
+	printf("%s\n  {\"name\": \"%s\", %s, \"bytes\": %zu, "
+	    "\"ops_per_sec\": %.1f, \"ns_per_op\": %.1f, ", sep, b->name,
+	    params, b->bytes, calls / (t1 - t0), (t1 - t0) * 1e9 / calls);
+#ifdef HAVE_RDTSC
+	printf("\"cycles_per_byte\": %.3f}",
+	    (double)(c1 - c0) / calls / b->bytes);
+#else
+	printf("\"cycles_per_byte\": null}");
+#endif
+	sep = ",";
+}
+
+static void
+bench_salsa20_8(struct bench * b)
+{
+
+	(void)b;
+	salsa20_8(XY);
+}
+
+static void
+bench_blockmix(struct bench * b)
+{
+
+	blockmix_salsa8(XY, &XY[32 * b->r], &XY[64 * b->r], b->r);
+}
+
+static void
+bench_smix(struct bench * b)
+{
+
+	smix(bufin, b->r, b->N, V, XY);
+}
+
+static void
+bench_pbkdf2(struct bench * b)
+{
+
+	PBKDF2_scrypt_SHA256(bufin, 8, &bufin[8], 32, 1, bufout, b->bytes);
+}
+
+static void
+bench_aesctr(struct bench * b)
+{
+	struct crypto_aesctr * AES;
+
+	if ((AES = crypto_aesctr_init(b->key, 0)) == NULL)
+		abort();
+	crypto_aesctr_stream(AES, bufin, bufout, b->bytes);
+	crypto_aesctr_free(AES);
+}
+
+static void
+bench_hmac(struct bench * b)
+{
+	HMAC_scrypt_SHA256_CTX hctx;
+
+	HMAC_scrypt_SHA256_Init(&hctx, bufin, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, bufin, b->bytes);
+	HMAC_scrypt_SHA256_Final(bufout, &hctx);
+}
+
+int
+main(int argc, char * argv[])
+{
+	static const size_t rs[] = { 1, 8, 16 };
+	static const int logNs[] = { 10, 12, 14 };
+	static const size_t lens[] = { 64, 1024, 65536, BUFSIZE };
+	struct bench b;
+	AES_KEY key;
+	char params[128];
+	size_t i, j;
+
+	/* The only option is the minimum running time of each benchmark. */
+	if (argc > 1 && (mintime = atof(argv[1])) <= 0) {
+		fprintf(stderr, "usage: %s [seconds per benchmark]\n", argv[0]);
+		exit(1);
+	}
+
+	/* Big enough for smix with N = 2^14 and r = 16. */
+	if (((bufin = calloc(1, BUFSIZE)) == NULL) ||
+	    ((bufout = calloc(1, BUFSIZE)) == NULL) ||
+	    ((V = calloc(1, (size_t)128 * 16 << 14)) == NULL) ||
+	    ((XY = calloc(1, 256 * 16 + 64)) == NULL)) {
+		perror("calloc");
+		exit(1);
+	}
+	if (AES_set_encrypt_key(bufin, 256, &key)) {
+		fprintf(stderr, "AES_set_encrypt_key failed\n");
+		exit(1);
+	}
+	b.key = &key;
+
+	printf("[");
+
+	b.name = "salsa20_8";
+	b.fn = bench_salsa20_8;
+	b.bytes = 64;
+	run(&b, "\"params\": {}");
+
+	b.name = "blockmix_salsa8";
+	b.fn = bench_blockmix;
+	for (i = 0; i < sizeof(rs) / sizeof(rs[0]); i++) {
+		b.r = rs[i];
+		b.bytes = 128 * b.r;
+		snprintf(params, sizeof(params), "\"params\": {\"r\": %zu}",
+		    b.r);
+		run(&b, params);
+	}
+
+	/* smix reads and writes N blocks of 128 * r bytes, twice. */
+	b.name = "smix";
+	b.fn = bench_smix;
+	for (i = 0; i < sizeof(logNs) / sizeof(logNs[0]); i++) {
+		for (j = 0; j < sizeof(rs) / sizeof(rs[0]); j++) {
+			b.N = (uint64_t)(1) << logNs[i];
+			b.r = rs[j];
+			b.bytes = 256 * b.r * b.N;
+			snprintf(params, sizeof(params),
+			    "\"params\": {\"N\": %llu, \"r\": %zu}",
+			    (unsigned long long)b.N, b.r);
+			run(&b, params);
+		}
+	}
+
+	/* As used by crypto_scrypt, with one iteration and p = 1. */
+	b.name = "PBKDF2_scrypt_SHA256";
+	b.fn = bench_pbkdf2;
+	for (i = 0; i < sizeof(rs) / sizeof(rs[0]); i++) {
+		b.bytes = 128 * rs[i];
+		snprintf(params, sizeof(params),
+		    "\"params\": {\"c\": 1, \"dkLen\": %zu}", b.bytes);
+		run(&b, params);
+	}
+
+	b.name = "crypto_aesctr_stream";
+	b.fn = bench_aesctr;
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		b.bytes = lens[i];
+		snprintf(params, sizeof(params),
+		    "\"params\": {\"len\": %zu}", b.bytes);
+		run(&b, params);
+	}
+
+	b.name = "HMAC_scrypt_SHA256";
+	b.fn = bench_hmac;
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		b.bytes = lens[i];
+		snprintf(params, sizeof(params),
+		    "\"params\": {\"len\": %zu}", b.bytes);
+		run(&b, params);
+	}
+
+	printf("\n]\n");
+
+	return (0);
+}
@@ -0,0 +1,171 @@
+"""Throughput and latency of the scrypt module under concurrency.
+
+Sweeps N, r, p, payload size and the number of threads or processes over
+scrypt.hash, scrypt.encrypt and scrypt.decrypt, and prints a JSON report
+with the throughput, p50/p99 latency and peak RSS of each run.  A threads
+run happens in a fresh child process, so that its peak RSS is its own; a
+processes run starts one fresh process per worker and releases them all at
+once, and its peak RSS is the sum of theirs.
+
+Build the module in place first, then run from the top of the tree:
+
+    python setup.py build_ext --inplace
+    PYTHONPATH=. python bench/scrypt-bench.py --quick > report.json
+"""
+
+import argparse
+import json
+import multiprocessing
+import resource
+import sys
+import threading
+import time
+
+import scrypt
+
+clock = getattr(time, 'perf_counter', time.time)
+
+PASSWORD = 'password'
+SALT = 'salt' * 8
+
+
+def make_op(workload, N, r, p, size):
+    """Return a function performing one call of the workload."""
+    data = 'x' * size
+    if workload == 'hash':
+        return lambda: scrypt.hash(PASSWORD, SALT, N=N, r=r, p=p)
+    if workload == 'encrypt':
+        return lambda: scrypt.encrypt(data, PASSWORD, N=N, r=r, p=p)
+    if workload == 'decrypt':
+        blob = scrypt.encrypt(data, PASSWORD, N=N, r=r, p=p)
+        # ceilings rather than maxtime, so that no run fails on a busy box
+        return lambda: scrypt.decrypt(blob, PASSWORD, maxN=N, maxrp=r * p)
+    raise ValueError(workload)
+
+
+def peak_rss():
+    """Peak resident set size of this process, in kB."""
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return rss // 1024 if sys.platform == 'darwin' else rss
+
+
+def timed_calls(op, count):
+    latencies = []
+    for i in range(count):
+        start = clock()
+        op()
+        latencies.append(clock() - start)
+    return latencies
+
+
+def process_worker(config, count, ready, go, results):
+    op = make_op(config['workload'], config['N'], config['r'], config['p'], config['size'])
+    # wait for the others, so that all workers make their calls in parallel
+    ready.put(None)
+    go.wait()
+    results.put((timed_calls(op, count), peak_rss()))
+
+
+def run_config(config):
+    """Run one configuration in this process or in new worker processes."""
+    workers, calls = config['concurrency'], config['calls']
+    counts = [calls // workers + (i < calls % workers) for i in range(workers)]
+
+    if config['mode'] == 'threads':
+        op = make_op(config['workload'], config['N'], config['r'], config['p'], config['size'])
+        results = [None] * workers
+
+        def work(i):
+            results[i] = timed_calls(op, counts[i])
+
+        threads = [threading.Thread(target=work, args=(i,)) for i in range(workers)]
+        start = clock()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        wall = clock() - start
+        latencies = sum(results, [])
+        rss = peak_rss()
+    else:
+        ready, go, queue = multiprocessing.Queue(), multiprocessing.Event(), multiprocessing.Queue()
+        procs = [multiprocessing.Process(target=process_worker, args=(config, c, ready, go, queue))
+                 for c in counts]
+        for proc in procs:
+            proc.start()
+        for proc in procs:
+            ready.get()
+        start = clock()
+        go.set()
+        results = [queue.get() for proc in procs]
+        wall = clock() - start
+        for proc in procs:
+            proc.join()
+        latencies = sum([r[0] for r in results], [])
+        rss = sum(r[1] for r in results)
+
+    latencies.sort()
+    result = dict(config)
+    result.update({
+        'ops_per_sec': len(latencies) / wall,
+        'bytes_per_sec': len(latencies) * config['size'] / wall,
+        'p50_ms': 1000 * latencies[len(latencies) // 2],
+        'p99_ms': 1000 * latencies[min(len(latencies) - 1, int(len(latencies) * .99))],
+        'peak_rss_kb': rss,
+    })
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--quick', action='store_true', help='sweep a small grid')
+    parser.add_argument('--calls', type=int, default=32, help='calls per run')
+    parser.add_argument('--workloads', default='hash,encrypt,decrypt')
+    parser.add_argument('--modes', default='threads,processes')
+    args = parser.parse_args()
+
+    ncpu = multiprocessing.cpu_count()
+    concurrency = sorted(set([1, 2, ncpu, 2 * ncpu]))
+    if args.quick:
+        grid = [(2**10, 8, 1), (2**14, 8, 1)]
+        sizes = [64, 65536]
+    else:
+        grid = [(N, r, p) for N in (2**10, 2**14, 2**16) for r in (1, 8, 16) for p in (1, 2)]
+        sizes = [64, 65536, 1 << 20]
+
+    configs = []
+    for workload in args.workloads.split(','):
+        for N, r, p in grid:
+            for size in (sizes if workload != 'hash' else [0]):
+                for mode in args.modes.split(','):
+                    for c in concurrency:
+                        configs.append({'workload': workload, 'N': N, 'r': r, 'p': p,
+                                        'size': size, 'mode': mode, 'concurrency': c,
+                                        'calls': max(args.calls, c)})
+
+    report = {
+        'python': sys.version.split()[0],
+        'platform': sys.platform,
+        'cpus': ncpu,
+        # the module has a single scrypt kernel and allocates V with mmap
+        'kernel': 'nosse',
+        'runs': [],
+    }
+    for config in configs:
+        if config['mode'] == 'processes':
+            # run_config starts a fresh process for each worker itself
+            report['runs'].append(run_config(config))
+        else:
+            pool = multiprocessing.Pool(1)
+            report['runs'].append(pool.apply(run_config, (config,)))
+            pool.close()
+            pool.join()
+        sys.stderr.write('.')
+    sys.stderr.write('\n')
+
+    json.dump(report, sys.stdout, indent=1, sort_keys=True)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -33,6 +33,7 @@
 
 #include <openssl/aes.h>
 
+#include "stats.h"
 #include "sysendian.h"
 
 #include "crypto_aesctr.h"
@@ -85,6 +86,7 @@ crypto_aesctr_stream(struct crypto_aesctr * stream, const uint8_t * inbuf,
 	uint8_t pblk[16];
 	size_t pos;
 	int bytemod;
+	uint64_t t0 = stats_start();
 
 	for (pos = 0; pos < buflen; pos++) {
 		/* How far through the buffer are we? */
@@ -103,6 +105,8 @@ crypto_aesctr_stream(struct crypto_aesctr * stream, const uint8_t * inbuf,
 		/* Move to the next byte of cipherstream. */
 		stream->bytectr += 1;
 	}
+
+	stats_end(STATS_AESCTR, t0, buflen);
 }
 
 /**
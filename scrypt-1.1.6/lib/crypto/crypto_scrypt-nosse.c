@@ -39,36 +39,39 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "metrics.h"
+#include "probes.h"
 #include "sha256.h"
+#include "stats.h"
 #include "sysendian.h"
 
 #include "crypto_scrypt.h"
 
-static void blkcpy(void *, void *, size_t);
-static void blkxor(void *, void *, size_t);
+static void blkcpy(void *, const void *, size_t);
+static void blkxor(void *, const void *, size_t);
 static void salsa20_8(uint32_t[16]);
 static void blockmix_salsa8(uint32_t *, uint32_t *, uint32_t *, size_t);
 static uint64_t integerify(void *, size_t);
 static void smix(uint8_t *, size_t, uint64_t, uint32_t *, uint32_t *);
 
+/*
+ * The blocks passed to blkcpy and blkxor are arrays of uint32_t; accessing
+ * them through any other (non-character) type breaks the strict aliasing
+ * rules and is miscompiled by optimizing compilers.
+ */
 static void
-blkcpy(void * dest, void * src, size_t len)
+blkcpy(void * dest, const void * src, size_t len)
 {
-	size_t * D = dest;
-	size_t * S = src;
-	size_t L = len / sizeof(size_t);
-	size_t i;
 
-	for (i = 0; i < L; i++)
-		D[i] = S[i];
+	memcpy(dest, src, len);
 }
 
 static void
-blkxor(void * dest, void * src, size_t len)
+blkxor(void * dest, const void * src, size_t len)
 {
-	size_t * D = dest;
-	size_t * S = src;
-	size_t L = len / sizeof(size_t);
+	uint32_t * D = dest;
+	const uint32_t * S = src;
+	size_t L = len / sizeof(uint32_t);
 	size_t i;
 
 	for (i = 0; i < L; i++)
@@ -182,12 +185,16 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 	uint64_t i;
 	uint64_t j;
 	size_t k;
+	uint64_t t0;
+
+	SCRYPT_PROBE2(smix__entry, N, r);
 
 	/* 1: X <-- B */
 	for (k = 0; k < 32 * r; k++)
 		X[k] = le32dec(&B[4 * k]);
 
 	/* 2: for i = 0 to N - 1 do */
+	t0 = stats_start();
 	for (i = 0; i < N; i += 2) {
 		/* 3: V_i <-- X */
 		blkcpy(&V[i * (32 * r)], X, 128 * r);
@@ -202,7 +209,10 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 		blockmix_salsa8(Y, X, Z, r);
 	}
 
+	stats_end(STATS_SMIX_FILL, t0, 128 * r * N);
+
 	/* 6: for i = 0 to N - 1 do */
+	t0 = stats_start();
 	for (i = 0; i < N; i += 2) {
 		/* 7: j <-- Integerify(X) mod N */
 		j = integerify(X, r) & (N - 1);
@@ -219,9 +229,13 @@ smix(uint8_t * B, size_t r, uint64_t N, uint32_t * V, uint32_t * XY)
 		blockmix_salsa8(Y, X, Z, r);
 	}
 
+	stats_end(STATS_SMIX_MIX, t0, 128 * r * N);
+
 	/* 10: B' <-- X */
 	for (k = 0; k < 32 * r; k++)
 		le32enc(&B[4 * k], X[k]);
+
+	SCRYPT_PROBE2(smix__return, N, r);
 }
 
 /**
@@ -243,6 +257,12 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 	uint32_t * V;
 	uint32_t * XY;
 	uint32_t i;
+	uint64_t t0;
+	uint64_t minflt0 = 0, majflt0 = 0;
+	uint64_t minflt, majflt;
+	uint64_t start = 0;
+
+	SCRYPT_PROBE4(kdf__entry, N, r, p, buflen);
 
 	/* Sanity-check parameters. */
 #if SIZE_MAX > UINT32_MAX
@@ -268,7 +288,14 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 		goto err0;
 	}
 
+	/* Note when we started and how many page faults we have taken. */
+	if (!stats_calibrating)
+		start = stats_now();
+	if (stats_enabled && !stats_calibrating)
+		stats_faults(&minflt0, &majflt0);
+
 	/* Allocate memory. */
+	t0 = stats_start();
 #ifdef _WIN32
 #undef HAVE_POSIX_MEMALIGN
 #endif
@@ -310,8 +337,14 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 	V = (uint32_t *)(V0);
 #endif
 
+	stats_end(STATS_ALLOC, t0, 128 * r * p + 256 * r + 64 + 128 * r * N);
+	if (start != 0)
+		metrics_vmem(128 * r * N);
+
 	/* 1: (B_0 ... B_{p-1}) <-- PBKDF2(P, S, 1, p * MFLen) */
+	t0 = stats_start();
 	PBKDF2_scrypt_SHA256(passwd, passwdlen, salt, saltlen, 1, B, p * 128 * r);
+	stats_end(STATS_PBKDF2_IN, t0, p * 128 * r);
 
 	/* 2: for i = 0 to p - 1 do */
 	for (i = 0; i < p; i++) {
@@ -320,9 +353,14 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 	}
 
 	/* 5: DK <-- PBKDF2(P, B, 1, dkLen) */
+	t0 = stats_start();
 	PBKDF2_scrypt_SHA256(passwd, passwdlen, B, p * 128 * r, 1, buf, buflen);
+	stats_end(STATS_PBKDF2_OUT, t0, buflen);
 
 	/* Free memory. */
+	if (start != 0)
+		metrics_vmem(-(int64_t)(128 * r * N));
+	t0 = stats_start();
 #ifdef MAP_ANON
 	if (munmap(V0, 128 * r * N))
 		goto err2;
@@ -331,8 +369,18 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
 #endif
 	free(XY0);
 	free(B0);
+	stats_end(STATS_FREE, t0, 128 * r * p + 256 * r + 64 + 128 * r * N);
+
+	/* Record how long it took and the page faults taken meanwhile. */
+	if (start != 0)
+		metrics_kdf(N, r, p, stats_now() - start);
+	if (stats_enabled && !stats_calibrating) {
+		stats_faults(&minflt, &majflt);
+		stats_record_faults(minflt - minflt0, majflt - majflt0);
+	}
 
 	/* Success! */
+	SCRYPT_PROBE4(kdf__return, N, r, p, 0);
 	return (0);
 
 err2:
@@ -341,5 +389,6 @@ err1:
 	free(B0);
 err0:
 	/* Failure! */
+	SCRYPT_PROBE4(kdf__return, N, r, p, -1);
 	return (-1);
 }
@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "stats.h"
 #include "sysendian.h"
 
 #include "sha256.h"
@@ -330,9 +331,12 @@ HMAC_scrypt_SHA256_Init(HMAC_scrypt_SHA256_CTX * ctx, const void * _K, size_t Kl
 void
 HMAC_scrypt_SHA256_Update(HMAC_scrypt_SHA256_CTX * ctx, const void *in, size_t len)
 {
+	uint64_t t0 = stats_start();
 
 	/* Feed data to the inner scrypt_SHA256 operation. */
 	scrypt_SHA256_Update(&ctx->ictx, in, len);
+
+	stats_end(STATS_HMAC, t0, len);
 }
 
 /* Finish an HMAC-scrypt_SHA256 operation. */
@@ -372,9 +376,15 @@ PBKDF2_scrypt_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 	int k;
 	size_t clen;
 
+	/*
+	 * Feed the inner hashes directly rather than through
+	 * HMAC_scrypt_SHA256_Update, so that the time spent here is
+	 * attributed to PBKDF2 rather than to HMAC.
+	 */
+
 	/* Compute HMAC state after processing P and S. */
 	HMAC_scrypt_SHA256_Init(&PShctx, passwd, passwdlen);
-	HMAC_scrypt_SHA256_Update(&PShctx, salt, saltlen);
+	scrypt_SHA256_Update(&PShctx.ictx, salt, saltlen);
 
 	/* Iterate through the blocks. */
 	for (i = 0; i * 32 < dkLen; i++) {
@@ -383,7 +393,7 @@ PBKDF2_scrypt_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 
 		/* Compute U_1 = PRF(P, S || INT(i)). */
 		memcpy(&hctx, &PShctx, sizeof(HMAC_scrypt_SHA256_CTX));
-		HMAC_scrypt_SHA256_Update(&hctx, ivec, 4);
+		scrypt_SHA256_Update(&hctx.ictx, ivec, 4);
 		HMAC_scrypt_SHA256_Final(U, &hctx);
 
 		/* T_i = U_1 ... */
@@ -392,7 +402,7 @@ PBKDF2_scrypt_SHA256(const uint8_t * passwd, size_t passwdlen, const uint8_t * s
 		for (j = 2; j <= c; j++) {
 			/* Compute U_j. */
 			HMAC_scrypt_SHA256_Init(&hctx, passwd, passwdlen);
-			HMAC_scrypt_SHA256_Update(&hctx, U, 32);
+			scrypt_SHA256_Update(&hctx.ictx, U, 32);
 			HMAC_scrypt_SHA256_Final(U, &hctx);
 
 			/* ... xor U_j ... */
@@ -0,0 +1,57 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _LIBSCRYPT_H_
+#define _LIBSCRYPT_H_
+
+/*
+ * Public interface of libscrypt, the shared library built by
+ * "python setup.py build_libscrypt": the scrypt key derivation function
+ * (crypto_scrypt), encryption and decryption of buffers, files, streams and
+ * sessions (scryptenc_* and scryptdec_*), the derived key cache and $7$
+ * password hashes.  See the included headers for each function.
+ */
+
+#define LIBSCRYPT_VERSION	"1.1.6"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "crypto_scrypt.h"
+#include "scryptenc.h"
+#include "scryptenc_batch.h"
+#include "scryptenc_cache.h"
+#include "scryptenc_mcf.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_LIBSCRYPT_H_ */
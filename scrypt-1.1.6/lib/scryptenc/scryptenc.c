@@ -28,35 +28,103 @@
  */
 #include "scrypt_platform.h"
 
-#include <errno.h>
-#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
+#endif
 
 #include <openssl/aes.h>
 
 #include "crypto_aesctr.h"
 #include "crypto_scrypt.h"
+#include "entropy.h"
 #include "memlimit.h"
+#include "metrics.h"
+#include "probes.h"
+#include "scryptenc_cache.h"
 #include "scryptenc_cpuperf.h"
 #include "sha256.h"
+#include "stats.h"
 #include "sysendian.h"
 
 #include "scryptenc.h"
 
-#ifdef _WIN32
-#include <windows.h>
-#include <Wincrypt.h>
-#endif
-
+/* Default size of the blocks read, processed and written by the file API. */
 #define ENCBLOCK 65536
 
+/* Buffers in flight between the reader, the caller and the writer. */
+#define FPIPE_NBUFS 3
+
+/* Size of the independently authenticated segments in format version 1. */
+#define SEGSIZE 65536
+
+/* Most threads used to open segments, and segments per thread per read. */
+#define SEG_MAXTHREADS 16
+#define SEG_BATCH 4
+
+/* Explicit scrypt parameters, used instead of measuring memory and CPU. */
+struct encparams {
+	int logN;
+	uint32_t r;
+	uint32_t p;
+};
+
 static int pickparams(size_t, double, double,
     int *, uint32_t *, uint32_t *);
 static int checkparams(size_t, double, double, int, uint32_t, uint32_t);
+static int checkceilings(const struct scryptdec_ceilings *, size_t, double,
+    double, int, uint32_t, uint32_t);
 static int getsalt(uint8_t[32]);
+static int scryptenc_setup_params(uint8_t[96], uint8_t[64], uint8_t,
+    const uint8_t *, size_t, int, uint32_t, uint32_t);
+static int setup_enc(uint8_t[96], uint8_t[64], uint8_t, const uint8_t *,
+    size_t, size_t, double, double, const struct encparams *);
+static int buf_seal(const uint8_t *, size_t, uint8_t *, const uint8_t[64]);
+static int buf_seal_seg(const uint8_t *, size_t, uint8_t *,
+    const uint8_t[64]);
+static struct scryptenc_stream * stream_init(const uint8_t[96],
+    const uint8_t[64]);
+static struct scryptenc_session * session_init(const uint8_t[96],
+    const uint8_t[64], int);
+static void session_mac(const struct scryptenc_session *, const uint8_t *,
+    size_t, uint8_t[32]);
+static int seg_layout(size_t, uint64_t *, size_t *);
+static void seg_mac(const HMAC_scrypt_SHA256_CTX *, uint64_t, int,
+    const uint8_t *, size_t, uint8_t[32]);
+static int seg_crypt(AES_KEY *, uint64_t, const uint8_t *, uint8_t *,
+    size_t);
+static int seg_open(const uint8_t *, size_t, uint64_t, int, AES_KEY *,
+    const HMAC_scrypt_SHA256_CTX *, uint8_t *);
+static void * seg_job_run(void *);
+static int seg_threads(void);
+static int seg_open_batch(const uint8_t *, uint64_t, uint64_t, size_t, int,
+    AES_KEY *, const HMAC_scrypt_SHA256_CTX *, uint8_t *);
+static int decbuf(const uint8_t *, size_t, uint8_t *, size_t *,
+    const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+static int scryptdec_buf_seg(const uint8_t *, size_t, uint8_t *, size_t *,
+    const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+struct spool;
+static int spool_write(struct spool *, const uint8_t *, size_t);
+static int outwrite(FILE *, struct spool *, const uint8_t *, size_t);
+static int scryptdec_file_seg(FILE *, FILE *, struct spool *, uint8_t[96],
+    const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
 
 static int
 pickparams(size_t maxmem, double maxmemfrac, double maxtime,
@@ -67,6 +135,7 @@ pickparams(size_t maxmem, double maxmemfrac, double maxtime,
 	double opslimit;
 	double maxN, maxrp;
 	int rc;
+	uint64_t t0 = stats_start();
 
 	/* Figure out how much memory to use. */
 	if (memtouse(maxmem, maxmemfrac, &memlimit))
@@ -76,6 +145,7 @@ pickparams(size_t maxmem, double maxmemfrac, double maxtime,
 	if ((rc = scryptenc_cpuperf(&opps)) != 0)
 		return (rc);
 	opslimit = opps * maxtime;
+	stats_end(STATS_CALIBRATE, t0, 0);
 
 	/* Allow a minimum of 2^15 salsa20/8 cores. */
 	if (opslimit < 32768)
@@ -134,6 +204,7 @@ checkparams(size_t maxmem, double maxmemfrac, double maxtime,
 	double opslimit;
 	uint64_t N;
 	int rc;
+	uint64_t t0 = stats_start();
 
 	/* Figure out the maximum amount of memory we can use. */
 	if (memtouse(maxmem, maxmemfrac, &memlimit))
@@ -143,10 +214,13 @@ checkparams(size_t maxmem, double maxmemfrac, double maxtime,
 	if ((rc = scryptenc_cpuperf(&opps)) != 0)
 		return (rc);
 	opslimit = opps * maxtime;
+	stats_end(STATS_CALIBRATE, t0, 0);
 
 	/* Sanity-check values. */
 	if ((logN < 1) || (logN > 63))
 		return (7);
+	if ((r == 0) || (p == 0))
+		return (7);
 	if ((uint64_t)(r) * (uint64_t)(p) >= 0x40000000)
 		return (7);
 
@@ -161,90 +235,126 @@ checkparams(size_t maxmem, double maxmemfrac, double maxtime,
 	return (0);
 }
 
+/**
+ * checkceilings(ceil, maxmem, maxmemfrac, maxtime, logN, r, p):
+ * Check whether the parameters N = 2^logN, r, and p are valid and within the
+ * ceilings ceil.  A ceiling of 0 is filled from the limits checkparams uses:
+ * without ceil->maxbytes the memory limit applies, and unless both ceil->maxN
+ * and ceil->maxrp bound the work, so does the time limit.
+ */
 static int
-getsalt(uint8_t salt[32])
+checkceilings(const struct scryptdec_ceilings * ceil, size_t maxmem,
+    double maxmemfrac, double maxtime, int logN, uint32_t r, uint32_t p)
 {
-	int fd;
-	ssize_t lenread;
-	uint8_t * buf = salt;
-	size_t buflen = 32;
-
-#ifndef _WIN32
-	/* Open /dev/urandom. */
-	if ((fd = open("/dev/urandom", O_RDONLY)) == -1)
-		goto err0;
+	size_t memlimit;
+	uint64_t maxbytes;
+	double opps;
+	uint64_t N;
+	int rc;
+	uint64_t t0;
 
-	/* Read bytes until we have filled the buffer. */
-	while (buflen > 0) {
-		if ((lenread = read(fd, buf, buflen)) == -1)
-			goto err1;
+	/* Sanity-check values. */
+	if ((logN < 1) || (logN > 63))
+		return (7);
+	if ((r == 0) || (p == 0))
+		return (7);
+	if ((uint64_t)(r) * (uint64_t)(p) >= 0x40000000)
+		return (7);
 
-		/* The random device should never EOF. */
-		if (lenread == 0)
-			goto err1;
+	/* Check ceilings; the work is 4 * N * r * p salsa20/8 cores. */
+	N = (uint64_t)(1) << logN;
+	if ((ceil->maxN != 0) && (N > ceil->maxN))
+		return (10);
+	if ((ceil->maxrp != 0) && ((uint64_t)(r) * p > ceil->maxrp))
+		return (10);
 
-		/* We're partly done. */
-		buf += lenread;
-		buflen -= lenread;
+	/* Check memory against the ceiling, or against the memory limit. */
+	if ((maxbytes = ceil->maxbytes) == 0) {
+		if (memtouse(maxmem, maxmemfrac, &memlimit))
+			return (1);
+		maxbytes = memlimit;
 	}
+	if ((maxbytes / N) / r < 128)
+		return (9);
 
-	/* Close the device. */
-	while (close(fd) == -1) {
-		if (errno != EINTR)
-			goto err0;
+	/* Without both work ceilings, check the time it would take. */
+	if ((ceil->maxN == 0) || (ceil->maxrp == 0)) {
+		t0 = stats_start();
+		if ((rc = scryptenc_cpuperf(&opps)) != 0)
+			return (rc);
+		stats_end(STATS_CALIBRATE, t0, 0);
+		if (((opps * maxtime) / N) / (r * p) < 4)
+			return (10);
 	}
 
 	/* Success! */
 	return (0);
+}
 
-err1:
-	close(fd);
-err0:
-	/* Failure! */
-	return (4);
-#else
-    HCRYPTPROV context;
-	DWORD error;
-
-    if(CryptAcquireContext(&context, NULL, NULL, PROV_RSA_AES, 0) == NTE_BAD_KEYSET)
-    {
-		if(!CryptAcquireContext(&context, NULL, NULL, PROV_RSA_AES, CRYPT_NEWKEYSET))
-		{
-			error = GetLastError();
-			printf("%x", error);
-			return (14);
-		}
-	}
+static int
+getsalt(uint8_t salt[32])
+{
 
-    if(CryptGenRandom(context, 32, buf))
-    {
-        buf += 32;
-        return (0);
-    }
-    else{return(15);}
-#endif
+	/* Read random bytes from the operating system. */
+	if (entropy_read(salt, 32))
+		return (4);
+
+	/* Success! */
+	return (0);
 }
 
 static int
-scryptenc_setup(uint8_t header[96], uint8_t dk[64],
+scryptenc_setup(uint8_t header[96], uint8_t dk[64], uint8_t version,
     const uint8_t * passwd, size_t passwdlen,
     size_t maxmem, double maxmemfrac, double maxtime)
 {
-	uint8_t salt[32];
-	uint8_t hbuf[32];
 	int logN;
-	uint64_t N;
 	uint32_t r;
 	uint32_t p;
-	scrypt_SHA256_CTX ctx;
-	uint8_t * key_hmac = &dk[32];
-	HMAC_scrypt_SHA256_CTX hctx;
 	int rc;
 
 	/* Pick values for N, r, p. */
 	if ((rc = pickparams(maxmem, maxmemfrac, maxtime,
 	    &logN, &r, &p)) != 0)
 		return (rc);
+
+	return (scryptenc_setup_params(header, dk, version, passwd, passwdlen,
+	    logN, r, p));
+}
+
+/*
+ * Generate the header and derived keys with the parameters ep or, if ep is
+ * NULL, with parameters picked to fit the memory and time limits.
+ */
+static int
+setup_enc(uint8_t header[96], uint8_t dk[64], uint8_t version,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct encparams * ep)
+{
+
+	if (ep != NULL)
+		return (scryptenc_setup_params(header, dk, version, passwd,
+		    passwdlen, ep->logN, ep->r, ep->p));
+	return (scryptenc_setup(header, dk, version, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime));
+}
+
+static int
+scryptenc_setup_params(uint8_t header[96], uint8_t dk[64], uint8_t version,
+    const uint8_t * passwd, size_t passwdlen, int logN, uint32_t r, uint32_t p)
+{
+	uint8_t salt[32];
+	uint8_t hbuf[32];
+	uint64_t N;
+	scrypt_SHA256_CTX ctx;
+	uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	int rc;
+
+	/* The header has room for log2(N) up to 255, but N has 64 bits. */
+	if ((logN < 1) || (logN > 63))
+		return (3);
 	N = (uint64_t)(1) << logN;
 
 	/* Get some salt. */
@@ -257,7 +367,7 @@ scryptenc_setup(uint8_t header[96], uint8_t dk[64],
 
 	/* Construct the file header. */
 	memcpy(header, "scrypt", 6);
-	header[6] = 0;
+	header[6] = version;
 	header[7] = logN;
 	be32enc(&header[8], r);
 	be32enc(&header[12], p);
@@ -282,7 +392,8 @@ scryptenc_setup(uint8_t header[96], uint8_t dk[64],
 static int
 scryptdec_setup(const uint8_t header[96], uint8_t dk[64],
     const uint8_t * passwd, size_t passwdlen,
-    size_t maxmem, double maxmemfrac, double maxtime)
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
 {
 	uint8_t salt[32];
 	uint8_t hbuf[32];
@@ -293,6 +404,7 @@ scryptdec_setup(const uint8_t header[96], uint8_t dk[64],
 	scrypt_SHA256_CTX ctx;
 	uint8_t * key_hmac = &dk[32];
 	HMAC_scrypt_SHA256_CTX hctx;
+	int cached;
 	int rc;
 
 	/* Parse N, r, p, salt. */
@@ -308,18 +420,28 @@ scryptdec_setup(const uint8_t header[96], uint8_t dk[64],
 	if (memcmp(&header[48], hbuf, 16))
 		return (7);
 
-	/*
-	 * Check whether the provided parameters are valid and whether the
-	 * key derivation function can be computed within the allowed memory
-	 * and CPU time.
-	 */
-	if ((rc = checkparams(maxmem, maxmemfrac, maxtime, logN, r, p)) != 0)
-		return (rc);
-
-	/* Compute the derived keys. */
-	N = (uint64_t)(1) << logN;
-	if (crypto_scrypt(passwd, passwdlen, salt, 32, N, r, p, dk, 64))
-		return (3);
+	/* If we derived keys under this header before, reuse them. */
+	cached = (scryptenc_cache_lookup(header, passwd, passwdlen, dk) == 0);
+	if (!cached) {
+		/*
+		 * Check whether the provided parameters are valid and whether
+		 * the key derivation function can be computed within the
+		 * allowed memory and CPU time, or within the given ceilings.
+		 */
+		if (ceil != NULL)
+			rc = checkceilings(ceil, maxmem, maxmemfrac, maxtime,
+			    logN, r, p);
+		else
+			rc = checkparams(maxmem, maxmemfrac, maxtime,
+			    logN, r, p);
+		if (rc != 0)
+			return (rc);
+
+		/* Compute the derived keys. */
+		N = (uint64_t)(1) << logN;
+		if (crypto_scrypt(passwd, passwdlen, salt, 32, N, r, p, dk, 64))
+			return (3);
+	}
 
 	/* Check header signature (i.e., verify password). */
 	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
@@ -328,6 +450,10 @@ scryptdec_setup(const uint8_t header[96], uint8_t dk[64],
 	if (memcmp(hbuf, &header[64], 32))
 		return (11);
 
+	/* Only keys which have been shown to be right get cached. */
+	if (!cached)
+		scryptenc_cache_insert(header, passwd, passwdlen, dk);
+
 	/* Success! */
 	return (0);
 }
@@ -344,22 +470,74 @@ scryptenc_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
     size_t maxmem, double maxmemfrac, double maxtime)
 {
 	uint8_t dk[64];
-	uint8_t hbuf[32];
-	uint8_t header[96];
-	uint8_t * key_enc = dk;
-	uint8_t * key_hmac = &dk[32];
 	int rc;
-	HMAC_scrypt_SHA256_CTX hctx;
-	AES_KEY key_enc_exp;
-	struct crypto_aesctr * AES;
+
+	SCRYPT_PROBE2(encbuf__entry, inbuflen, maxmem);
 
 	/* Generate the header and derived key. */
-	if ((rc = scryptenc_setup(header, dk, passwd, passwdlen,
+	if ((rc = scryptenc_setup(outbuf, dk, 0, passwd, passwdlen,
 	    maxmem, maxmemfrac, maxtime)) != 0)
+		goto done;
+
+	/* Encrypt and sign the data. */
+	rc = buf_seal(inbuf, inbuflen, outbuf, dk);
+
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+
+done:
+	SCRYPT_PROBE2(encbuf__return, inbuflen, rc);
+	return (rc);
+}
+
+/**
+ * scryptenc_buf_params(inbuf, inbuflen, outbuf, passwd, passwdlen,
+ *     logN, r, p, segmented):
+ * Encrypt inbuflen bytes from inbuf as scryptenc_buf does, or as
+ * scryptenc_buf_seg does if segmented is non-zero, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int
+scryptenc_buf_params(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    const uint8_t * passwd, size_t passwdlen, int logN, uint32_t r,
+    uint32_t p, int segmented)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = scryptenc_setup_params(outbuf, dk, segmented ? 1 : 0,
+	    passwd, passwdlen, logN, r, p)) != 0)
 		return (rc);
 
-	/* Copy header into output buffer. */
-	memcpy(outbuf, header, 96);
+	/* Encrypt and sign the data. */
+	if (segmented)
+		rc = buf_seal_seg(inbuf, inbuflen, outbuf, dk);
+	else
+		rc = buf_seal(inbuf, inbuflen, outbuf, dk);
+
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+
+	return (rc);
+}
+
+/**
+ * buf_seal(inbuf, inbuflen, outbuf, dk):
+ * Encrypt and sign inbuflen bytes from inbuf in format version 0 with the
+ * derived keys dk, writing them after the 96-byte header in outbuf.
+ */
+static int
+buf_seal(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    const uint8_t dk[64])
+{
+	uint8_t hbuf[32];
+	const uint8_t * key_enc = dk;
+	const uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	AES_KEY key_enc_exp;
+	struct crypto_aesctr * AES;
 
 	/* Encrypt data. */
 	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp))
@@ -368,6 +546,7 @@ scryptenc_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
 		return (6);
 	crypto_aesctr_stream(AES, inbuf, &outbuf[96], inbuflen);
 	crypto_aesctr_free(AES);
+	metrics_encrypted(inbuflen);
 
 	/* Add signature. */
 	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
@@ -376,7 +555,6 @@ scryptenc_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
 	memcpy(&outbuf[96 + inbuflen], hbuf, 32);
 
 	/* Zero sensitive data. */
-	memset(dk, 0, 64);
 	memset(&key_enc_exp, 0, sizeof(AES_KEY));
 
 	/* Success! */
@@ -394,6 +572,48 @@ int
 scryptdec_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
     size_t * outlen, const uint8_t * passwd, size_t passwdlen,
     size_t maxmem, double maxmemfrac, double maxtime)
+{
+	int rc;
+
+	SCRYPT_PROBE2(decbuf__entry, inbuflen, maxmem);
+	rc = decbuf(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL);
+	SCRYPT_PROBE2(decbuf__return, (rc == 0) ? *outlen : 0, rc);
+
+	return (rc);
+}
+
+/**
+ * scryptdec_buf_ceil(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt inbuflen bytes from inbuf as scryptdec_buf does, but refuse data
+ * whose parameters exceed the ceilings ceil, if it is not NULL.  Ceilings
+ * left at 0 fall back to the memory and time limits; with all three set,
+ * the available memory and the speed of the CPU are never measured.
+ */
+int
+scryptdec_buf_ceil(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    size_t * outlen, const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+
+	return (decbuf(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil));
+}
+
+/**
+ * decbuf(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt inbuflen bytes from inbuf, checking the parameters against the
+ * ceilings ceil if it is not NULL, or against the memory and time limits
+ * otherwise.
+ */
+static int
+decbuf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    size_t * outlen, const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
 {
 	uint8_t hbuf[32];
 	uint8_t dk[64];
@@ -411,17 +631,20 @@ scryptdec_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
 	if ((inbuflen < 7) || (memcmp(inbuf, "scrypt", 6) != 0))
 		return (7);
 
-	/* Check the format. */
-	if (inbuf[6] != 0)
-		return (8);
-
 	/* We must have at least 128 bytes. */
 	if (inbuflen < 128)
 		return (7);
 
+	/* Check the format. */
+	if (inbuf[6] == 1)
+		return (scryptdec_buf_seg(inbuf, inbuflen, outbuf, outlen,
+		    passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil));
+	if (inbuf[6] != 0)
+		return (8);
+
 	/* Parse the header and generate derived keys. */
 	if ((rc = scryptdec_setup(inbuf, dk, passwd, passwdlen,
-	    maxmem, maxmemfrac, maxtime)) != 0)
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
 		return (rc);
 
 	/* Decrypt data. */
@@ -431,6 +654,7 @@ scryptdec_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
 		return (6);
 	crypto_aesctr_stream(AES, &inbuf[96], outbuf, inbuflen - 128);
 	crypto_aesctr_free(AES);
+	metrics_decrypted(inbuflen - 128);
 	*outlen = inbuflen - 128;
 
 	/* Verify signature. */
@@ -449,118 +673,1900 @@ scryptdec_buf(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
 }
 
 /**
- * scryptenc_file(infile, outfile, passwd, passwdlen,
- *     maxmem, maxmemfrac, maxtime):
- * Read a stream from infile and encrypt it, writing the resulting stream to
- * outfile.
+ * scryptenc_inspect(inbuf, inbuflen, logN, r, p, salt):
+ * Parse the header of the encrypted data inbuf without deriving any keys,
+ * verifying its checksum, and store the scrypt parameters N = 2^logN, r,
+ * and p and the 32-byte salt.  Return 0 on success; 7 if inbuf does not
+ * start with a valid header; or 8 if its format is not recognized.
  */
 int
-scryptenc_file(FILE * infile, FILE * outfile,
-    const uint8_t * passwd, size_t passwdlen,
-    size_t maxmem, double maxmemfrac, double maxtime)
+scryptenc_inspect(const uint8_t * inbuf, size_t inbuflen, int * logN,
+    uint32_t * r, uint32_t * p, uint8_t salt[32])
 {
-	uint8_t buf[ENCBLOCK];
-	uint8_t dk[64];
 	uint8_t hbuf[32];
-	uint8_t header[96];
-	uint8_t * key_enc = dk;
-	uint8_t * key_hmac = &dk[32];
-	size_t readlen;
-	HMAC_scrypt_SHA256_CTX hctx;
-	AES_KEY key_enc_exp;
-	struct crypto_aesctr * AES;
-	int rc;
-
-	/* Generate the header and derived key. */
-	if ((rc = scryptenc_setup(header, dk, passwd, passwdlen,
-	    maxmem, maxmemfrac, maxtime)) != 0)
-		return (rc);
+	scrypt_SHA256_CTX ctx;
 
-	/* Hash and write the header. */
-	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
-	HMAC_scrypt_SHA256_Update(&hctx, header, 96);
-	if (fwrite(header, 96, 1, outfile) != 1)
-		return (12);
+	/* Check the magic and the format. */
+	if ((inbuflen < 7) || (memcmp(inbuf, "scrypt", 6) != 0))
+		return (7);
+	if (inbuf[6] > 2)
+		return (8);
 
-	/*
-	 * Read blocks of data, encrypt them, and write them out; hash the
-	 * data as it is produced.
-	 */
-	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp))
-		return (5);
-	if ((AES = crypto_aesctr_init(&key_enc_exp, 0)) == NULL)
-		return (6);
-	do {
-		if ((readlen = fread(buf, 1, ENCBLOCK, infile)) == 0)
-			break;
-		crypto_aesctr_stream(AES, buf, buf, readlen);
-		HMAC_scrypt_SHA256_Update(&hctx, buf, readlen);
-		if (fwrite(buf, 1, readlen, outfile) < readlen)
-			return (12);
-	} while (1);
-	crypto_aesctr_free(AES);
+	/* All formats we know have a 96-byte header. */
+	if (inbuflen < 96)
+		return (7);
 
-	/* Did we exit the loop due to a read error? */
-	if (ferror(infile))
-		return (13);
+	/* Verify header checksum. */
+	scrypt_SHA256_Init(&ctx);
+	scrypt_SHA256_Update(&ctx, inbuf, 48);
+	scrypt_SHA256_Final(hbuf, &ctx);
+	if (memcmp(&inbuf[48], hbuf, 16))
+		return (7);
 
-	/* Compute the final HMAC and output it. */
-	HMAC_scrypt_SHA256_Final(hbuf, &hctx);
-	if (fwrite(hbuf, 32, 1, outfile) != 1)
-		return (12);
+	/* Parse N, r, p, salt. */
+	*logN = inbuf[7];
+	*r = be32dec(&inbuf[8]);
+	*p = be32dec(&inbuf[12]);
+	memcpy(salt, &inbuf[16], 32);
 
-	/* Zero sensitive data. */
-	memset(dk, 0, 64);
-	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+	/* Reject parameters which checkparams would never accept. */
+	if ((*logN < 1) || (*logN > 63))
+		return (7);
+	if ((*r == 0) || (*p == 0))
+		return (7);
+	if ((uint64_t)(*r) * (uint64_t)(*p) >= 0x40000000)
+		return (7);
 
 	/* Success! */
 	return (0);
 }
 
+/*
+ * Format version 1 uses the same 96-byte header as version 0, followed by
+ * the data split into segments of SEGSIZE bytes (the last one may be
+ * shorter, and there is always at least one).  Segment i is encrypted with
+ * AES-CTR using i as the nonce, and followed by a 32-byte HMAC of the
+ * header, i, a byte which is 1 for the last segment and 0 otherwise, and
+ * the encrypted segment.  Any segment can thus be authenticated and
+ * decrypted on its own, and truncating the data is detected when the new
+ * last segment is checked.
+ */
+
+/* A run of consecutive segments to be opened by one thread. */
+struct seg_job {
+	const uint8_t * segs;
+	uint8_t * outbuf;
+	uint64_t firstseg;
+	uint64_t nsegs;
+	size_t lastlen;
+	int final;
+	AES_KEY * key;
+	const HMAC_scrypt_SHA256_CTX * hctx;
+	int rc;
+};
+
+/* Number of threads used to open segments; 0 means one per CPU. */
+static int seg_nthreads = 0;
+
 /**
- * scryptdec_file(infile, outfile, passwd, passwdlen,
- *     maxmem, maxmemfrac, maxtime):
- * Read a stream from infile and decrypt it, writing the resulting stream to
- * outfile.
+ * seg_layout(bodylen, nsegs, plainlen):
+ * Work out the number of segments in, and the length of the data held by,
+ * bodylen bytes of version 1 segments running to the end of the block.
+ * Return 0 on success; or -1 if no valid block has that length.
  */
-int
-scryptdec_file(FILE * infile, FILE * outfile,
-    const uint8_t * passwd, size_t passwdlen,
-    size_t maxmem, double maxmemfrac, double maxtime)
+static int
+seg_layout(size_t bodylen, uint64_t * nsegs, size_t * plainlen)
 {
-	uint8_t buf[ENCBLOCK + 32];
-	uint8_t header[96];
-	uint8_t hbuf[32];
-	uint8_t dk[64];
-	uint8_t * key_enc = dk;
-	uint8_t * key_hmac = &dk[32];
-	size_t buflen = 0;
-	size_t readlen;
-	HMAC_scrypt_SHA256_CTX hctx;
-	AES_KEY key_enc_exp;
-	struct crypto_aesctr * AES;
-	int rc;
+	size_t lastlen;
 
-	/*
-	 * Read the first 7 bytes of the file; all future version of scrypt
-	 * are guaranteed to have at least 7 bytes of header.
-	 */
-	if (fread(header, 7, 1, infile) < 1) {
-		if (ferror(infile))
-			return (13);
-		else
-			return (7);
-	}
+	/* We need at least one signature. */
+	if (bodylen < 32)
+		return (-1);
 
-	/* Do we have the right magic? */
-	if (memcmp(header, "scrypt", 6))
-		return (7);
-	if (header[6] != 0)
-		return (8);
+	/* Every segment but the last is SEGSIZE + 32 bytes long. */
+	*nsegs = (bodylen + SEGSIZE + 32 - 1) / (SEGSIZE + 32);
+	lastlen = bodylen - (*nsegs - 1) * (SEGSIZE + 32);
 
-	/*
-	 * Read another 89 bytes of the file; version 0 of the srypt file
-	 * format has a 96-byte header.
+	/* The last segment needs its signature, and data unless it is alone. */
+	if ((lastlen < 32) || ((lastlen == 32) && (*nsegs > 1)))
+		return (-1);
+
+	*plainlen = bodylen - *nsegs * 32;
+	return (0);
+}
+
+/**
+ * seg_mac(hctx, segnum, last, ct, ctlen, sig):
+ * Compute the signature of segment segnum, whose encrypted contents are the
+ * ctlen bytes at ct, given an HMAC state hctx which has absorbed the header.
+ */
+static void
+seg_mac(const HMAC_scrypt_SHA256_CTX * hctx, uint64_t segnum, int last,
+    const uint8_t * ct, size_t ctlen, uint8_t sig[32])
+{
+	HMAC_scrypt_SHA256_CTX segctx;
+	uint8_t segid[9];
+
+	be64enc(segid, segnum);
+	segid[8] = last ? 1 : 0;
+
+	memcpy(&segctx, hctx, sizeof(HMAC_scrypt_SHA256_CTX));
+	HMAC_scrypt_SHA256_Update(&segctx, segid, 9);
+	HMAC_scrypt_SHA256_Update(&segctx, ct, ctlen);
+	HMAC_scrypt_SHA256_Final(sig, &segctx);
+}
+
+/**
+ * seg_crypt(key, segnum, inbuf, outbuf, buflen):
+ * Encrypt or decrypt the buflen bytes of segment segnum.
+ */
+static int
+seg_crypt(AES_KEY * key, uint64_t segnum, const uint8_t * inbuf,
+    uint8_t * outbuf, size_t buflen)
+{
+	struct crypto_aesctr * AES;
+
+	if ((AES = crypto_aesctr_init(key, segnum)) == NULL)
+		return (6);
+	crypto_aesctr_stream(AES, inbuf, outbuf, buflen);
+	crypto_aesctr_free(AES);
+
+	return (0);
+}
+
+/**
+ * seg_open(ct, seglen, segnum, last, key, hctx, outbuf):
+ * Verify segment segnum, which has seglen bytes of data at ct followed by
+ * its signature and is the last segment if last is non-zero, and decrypt
+ * it into outbuf.
+ */
+static int
+seg_open(const uint8_t * ct, size_t seglen, uint64_t segnum, int last,
+    AES_KEY * key, const HMAC_scrypt_SHA256_CTX * hctx, uint8_t * outbuf)
+{
+	uint8_t hbuf[32];
+
+	/* Verify the signature before decrypting anything. */
+	seg_mac(hctx, segnum, last, ct, seglen, hbuf);
+	if (memcmp(hbuf, &ct[seglen], 32))
+		return (7);
+
+	metrics_decrypted(seglen);
+	return (seg_crypt(key, segnum, ct, outbuf, seglen));
+}
+
+/**
+ * seg_job_run(cookie):
+ * Open the segments described by the seg_job cookie, recording the result
+ * in its rc field.
+ */
+static void *
+seg_job_run(void * cookie)
+{
+	struct seg_job * job = cookie;
+	uint64_t i;
+	size_t seglen;
+	int last;
+
+	for (i = 0; i < job->nsegs; i++) {
+		last = (i == job->nsegs - 1);
+		seglen = last ? job->lastlen : SEGSIZE;
+		if ((job->rc = seg_open(&job->segs[i * (SEGSIZE + 32)], seglen,
+		    job->firstseg + i, last && job->final, job->key, job->hctx,
+		    &job->outbuf[i * SEGSIZE])) != 0)
+			break;
+	}
+
+	return (NULL);
+}
+
+/**
+ * seg_threads(void):
+ * Return the number of threads to open segments with.
+ */
+static int
+seg_threads(void)
+{
+	long nthreads = seg_nthreads;
+
+#ifndef _WIN32
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > SEG_MAXTHREADS)
+		nthreads = SEG_MAXTHREADS;
+
+	return ((int)nthreads);
+}
+
+/**
+ * seg_open_batch(segs, firstseg, nsegs, lastlen, final, key, hctx, outbuf):
+ * Verify and decrypt the nsegs consecutive segments at segs, the first of
+ * which is segment firstseg, into outbuf.  All but the last of them hold
+ * SEGSIZE bytes, and the last holds lastlen bytes and is the last segment
+ * of the block if final is non-zero.  The work is spread over several
+ * threads; the output is in segment order either way.
+ */
+static int
+seg_open_batch(const uint8_t * segs, uint64_t firstseg, uint64_t nsegs,
+    size_t lastlen, int final, AES_KEY * key,
+    const HMAC_scrypt_SHA256_CTX * hctx, uint8_t * outbuf)
+{
+	struct seg_job jobs[SEG_MAXTHREADS];
+#ifndef _WIN32
+	pthread_t threads[SEG_MAXTHREADS];
+	int started[SEG_MAXTHREADS];
+#endif
+	uint64_t pos = 0;
+	uint64_t count;
+	int nthreads;
+	int i;
+	int rc = 0;
+
+	/* Starting a thread is not worth it for a couple of segments. */
+	nthreads = seg_threads();
+	if ((uint64_t)nthreads > nsegs / 2)
+		nthreads = (nsegs >= 2) ? (int)(nsegs / 2) : 1;
+
+	/* Give each thread a run of consecutive segments. */
+	for (i = 0; i < nthreads; i++) {
+		count = nsegs / nthreads + ((uint64_t)i < nsegs % nthreads);
+		jobs[i].segs = &segs[pos * (SEGSIZE + 32)];
+		jobs[i].outbuf = &outbuf[pos * SEGSIZE];
+		jobs[i].firstseg = firstseg + pos;
+		jobs[i].nsegs = count;
+		jobs[i].lastlen = (pos + count == nsegs) ? lastlen : SEGSIZE;
+		jobs[i].final = (pos + count == nsegs) ? final : 0;
+		jobs[i].key = key;
+		jobs[i].hctx = hctx;
+		jobs[i].rc = 0;
+		pos += count;
+	}
+
+#ifndef _WIN32
+	/* Run the first run here and the others in new threads. */
+	for (i = 1; i < nthreads; i++)
+		started[i] = (pthread_create(&threads[i], NULL, seg_job_run,
+		    &jobs[i]) == 0);
+	seg_job_run(&jobs[0]);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			seg_job_run(&jobs[i]);
+	}
+#else
+	for (i = 0; i < nthreads; i++)
+		seg_job_run(&jobs[i]);
+#endif
+
+	/* Report the first failure. */
+	for (i = 0; i < nthreads; i++) {
+		if ((rc = jobs[i].rc) != 0)
+			break;
+	}
+
+	return (rc);
+}
+
+/**
+ * scryptdec_set_threads(nthreads):
+ * Set the number of threads used to decrypt data in the segmented format.
+ * If nthreads is 0, use one thread per CPU.
+ */
+void
+scryptdec_set_threads(int nthreads)
+{
+
+	seg_nthreads = (nthreads > 0) ? nthreads : 0;
+}
+
+/**
+ * scryptenc_buf_seg_len(inbuflen):
+ * Return the length of the output of scryptenc_buf_seg for inbuflen bytes
+ * of input.
+ */
+size_t
+scryptenc_buf_seg_len(size_t inbuflen)
+{
+	size_t nsegs;
+
+	nsegs = (inbuflen + SEGSIZE - 1) / SEGSIZE;
+	if (nsegs == 0)
+		nsegs = 1;
+
+	return (96 + inbuflen + nsegs * 32);
+}
+
+/**
+ * scryptenc_buf_seg(inbuf, inbuflen, outbuf, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Encrypt inbuflen bytes from inbuf into the segmented format (version 1),
+ * writing the resulting scryptenc_buf_seg_len(inbuflen) bytes to outbuf.
+ */
+int
+scryptenc_buf_seg(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = scryptenc_setup(outbuf, dk, 1, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime)) != 0)
+		return (rc);
+
+	/* Encrypt and sign the segments. */
+	rc = buf_seal_seg(inbuf, inbuflen, outbuf, dk);
+
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+
+	return (rc);
+}
+
+/**
+ * buf_seal_seg(inbuf, inbuflen, outbuf, dk):
+ * Encrypt and sign inbuflen bytes from inbuf as version 1 segments with the
+ * derived keys dk, writing them after the 96-byte header in outbuf.
+ */
+static int
+buf_seal_seg(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    const uint8_t dk[64])
+{
+	const uint8_t * key_enc = dk;
+	const uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	AES_KEY key_enc_exp;
+	uint64_t segnum = 0;
+	size_t pos = 0;
+	size_t seglen;
+	uint8_t * ct = &outbuf[96];
+	int rc = 0;
+
+	/* Set up the cipher and the signature state shared by all segments. */
+	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp))
+		return (5);
+	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, outbuf, 96);
+
+	/* Encrypt and sign each segment. */
+	do {
+		seglen = inbuflen - pos;
+		if (seglen > SEGSIZE)
+			seglen = SEGSIZE;
+		if ((rc = seg_crypt(&key_enc_exp, segnum, &inbuf[pos], ct,
+		    seglen)) != 0)
+			break;
+		seg_mac(&hctx, segnum, pos + seglen == inbuflen, ct, seglen,
+		    &ct[seglen]);
+		ct += seglen + 32;
+		pos += seglen;
+		segnum++;
+	} while (pos < inbuflen);
+	metrics_encrypted(pos);
+
+	/* Zero sensitive data. */
+	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+	memset(&hctx, 0, sizeof(HMAC_scrypt_SHA256_CTX));
+
+	return (rc);
+}
+
+/**
+ * scryptdec_buf_seg(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt the version 1 block inbuf as decbuf.
+ */
+static int
+scryptdec_buf_seg(const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf,
+    size_t * outlen, const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t dk[64];
+	uint8_t * key_enc = dk;
+	uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	AES_KEY key_enc_exp;
+	uint64_t nsegs;
+	size_t plainlen;
+	int rc;
+
+	/* Find out where the segments are. */
+	if ((inbuflen < 96) || seg_layout(inbuflen - 96, &nsegs, &plainlen))
+		return (7);
+
+	/* Parse the header and generate derived keys. */
+	if ((rc = scryptdec_setup(inbuf, dk, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
+		return (rc);
+
+	/* Set up the cipher and the signature state shared by all segments. */
+	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp)) {
+		rc = 5;
+		goto err0;
+	}
+	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, inbuf, 96);
+
+	/* Verify and decrypt every segment. */
+	if ((rc = seg_open_batch(&inbuf[96], 0, nsegs,
+	    plainlen - (nsegs - 1) * SEGSIZE, 1, &key_enc_exp, &hctx,
+	    outbuf)) != 0)
+		goto err0;
+	*outlen = plainlen;
+
+err0:
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+	memset(&hctx, 0, sizeof(HMAC_scrypt_SHA256_CTX));
+
+	return (rc);
+}
+
+/**
+ * readat(fd, buf, len, off):
+ * Read len bytes at offset off of the file open as fd into buf, without
+ * moving the file offset.  Return 0 on success; or 13 on failure, including
+ * end of file.
+ */
+static int
+readat(int fd, uint8_t * buf, size_t len, uint64_t off)
+{
+#ifndef _WIN32
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = pread(fd, buf, len, (off_t)off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (13);
+		}
+		if (n == 0)
+			return (13);
+		buf += n;
+		len -= (size_t)n;
+		off += (uint64_t)n;
+	}
+
+	/* Success! */
+	return (0);
+#else
+	(void)fd;
+	(void)buf;
+	(void)len;
+	(void)off;
+
+	/* No positioned reads here. */
+	return (13);
+#endif
+}
+
+/**
+ * decrange(inbuf, fd, inlen, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt a range of the inlen-byte version 1 block held in inbuf or, if
+ * inbuf is NULL, in the file open as fd, as scryptdec_buf_range does.
+ * Only the header and the segments which overlap the range are read.
+ */
+static int
+decrange(const uint8_t * inbuf, int fd, uint64_t inlen,
+    uint64_t offset, size_t length, uint8_t * outbuf, size_t * outlen,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t header[96];
+	uint8_t dk[64];
+	uint8_t * key_enc = dk;
+	uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	AES_KEY key_enc_exp;
+	uint8_t * segbuf;
+	const uint8_t * ct;
+	uint64_t nsegs;
+	uint64_t segnum;
+	uint64_t segstart, segend;
+	uint64_t start, end;
+	size_t plainlen;
+	int last;
+	int rc;
+
+	/* Get the header. */
+	if (inlen < 7)
+		return (7);
+	if (inbuf != NULL)
+		memcpy(header, inbuf, (inlen < 96) ? (size_t)inlen : 96);
+	else if ((rc = readat(fd, header, (inlen < 96) ? (size_t)inlen : 96,
+	    0)) != 0)
+		return (rc);
+
+	/* Check the magic and the format. */
+	if (memcmp(header, "scrypt", 6) != 0)
+		return (7);
+	if (header[6] != 1)
+		return (8);
+
+	/* Find out where the segments are. */
+	if ((inlen < 96) || (inlen - 96 > SIZE_MAX) ||
+	    seg_layout((size_t)(inlen - 96), &nsegs, &plainlen))
+		return (7);
+
+	/* Parse the header and generate derived keys. */
+	if ((rc = scryptdec_setup(header, dk, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
+		return (rc);
+
+	/* Clip the range to the data we have. */
+	if (offset > plainlen)
+		offset = plainlen;
+	if (length > plainlen - offset)
+		length = plainlen - offset;
+	*outlen = length;
+
+	/* Segments read from the file, or partly wanted, are opened here. */
+	if ((segbuf = malloc(SEGSIZE + 32)) == NULL) {
+		rc = 6;
+		goto err0;
+	}
+
+	/* Set up the cipher and the signature state shared by all segments. */
+	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp)) {
+		rc = 5;
+		goto err1;
+	}
+	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, header, 96);
+
+	/* Open the segments which overlap the range, if it isn't empty. */
+	for (segnum = offset / SEGSIZE;
+	    (length > 0) && (segnum * SEGSIZE < offset + length); segnum++) {
+		last = (segnum == nsegs - 1);
+		segstart = segnum * SEGSIZE;
+		segend = last ? plainlen : segstart + SEGSIZE;
+
+		/* Fetch the segment and its signature. */
+		if (inbuf != NULL) {
+			ct = &inbuf[96 + segnum * (SEGSIZE + 32)];
+		} else {
+			if ((rc = readat(fd, segbuf, segend - segstart + 32,
+			    96 + segnum * (SEGSIZE + 32))) != 0)
+				goto err1;
+			ct = segbuf;
+		}
+
+		/* Segments which lie entirely in the range go straight out. */
+		if ((segstart >= offset) && (segend <= offset + length)) {
+			if ((rc = seg_open(ct, segend - segstart, segnum, last,
+			    &key_enc_exp, &hctx,
+			    &outbuf[segstart - offset])) != 0)
+				goto err1;
+			continue;
+		}
+
+		/* Others are decrypted on the side and copied in part. */
+		if ((rc = seg_open(ct, segend - segstart, segnum, last,
+		    &key_enc_exp, &hctx, segbuf)) != 0)
+			goto err1;
+		start = (segstart > offset) ? segstart : offset;
+		end = (segend < offset + length) ? segend : offset + length;
+		memcpy(&outbuf[start - offset], &segbuf[start - segstart],
+		    end - start);
+	}
+
+err1:
+	memset(segbuf, 0, SEGSIZE + 32);
+	free(segbuf);
+err0:
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+	memset(&hctx, 0, sizeof(HMAC_scrypt_SHA256_CTX));
+
+	return (rc);
+}
+
+/**
+ * scryptdec_buf_range(inbuf, inbuflen, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime):
+ * Decrypt up to length bytes starting at offset of the data in the version 1
+ * block inbuf, writing them into outbuf and their number to outlen.  Only
+ * the segments holding the requested bytes are authenticated and
+ * decrypted.  The allocated length of outbuf must be at least length.
+ */
+int
+scryptdec_buf_range(const uint8_t * inbuf, size_t inbuflen,
+    uint64_t offset, size_t length, uint8_t * outbuf, size_t * outlen,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (decrange(inbuf, -1, inbuflen, offset, length, outbuf, outlen,
+	    passwd, passwdlen, maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_buf_range_ceil(inbuf, inbuflen, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt a range as scryptdec_buf_range does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int
+scryptdec_buf_range_ceil(const uint8_t * inbuf, size_t inbuflen,
+    uint64_t offset, size_t length, uint8_t * outbuf, size_t * outlen,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+
+	return (decrange(inbuf, -1, inbuflen, offset, length, outbuf, outlen,
+	    passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil));
+}
+
+/**
+ * scryptdec_fd_range(fd, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime):
+ * Decrypt a range of the version 1 block held in the file open as fd, as
+ * scryptdec_buf_range does.  Only the header and the segments holding the
+ * requested bytes are read, with positioned reads which leave the file
+ * offset alone; this is not supported on Windows.
+ */
+int
+scryptdec_fd_range(int fd, uint64_t offset, size_t length,
+    uint8_t * outbuf, size_t * outlen,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (scryptdec_fd_range_ceil(fd, offset, length, outbuf, outlen,
+	    passwd, passwdlen, maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_fd_range_ceil(fd, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt a range as scryptdec_fd_range does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int
+scryptdec_fd_range_ceil(int fd, uint64_t offset, size_t length,
+    uint8_t * outbuf, size_t * outlen,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+#ifndef _WIN32
+	struct stat sb;
+
+	/* The segment layout follows from the length of the file. */
+	if (fstat(fd, &sb))
+		return (13);
+
+	return (decrange(NULL, fd, (uint64_t)sb.st_size, offset, length,
+	    outbuf, outlen, passwd, passwdlen, maxmem, maxmemfrac, maxtime,
+	    ceil));
+#else
+	(void)fd;
+	(void)offset;
+	(void)length;
+	(void)outbuf;
+	(void)outlen;
+	(void)passwd;
+	(void)passwdlen;
+	(void)maxmem;
+	(void)maxmemfrac;
+	(void)maxtime;
+	(void)ceil;
+
+	/* No positioned reads here. */
+	return (13);
+#endif
+}
+
+/*
+ * Plaintext which must not be released until the whole input has been
+ * authenticated is held in a spool: in memory up to max bytes, and beyond
+ * that in an anonymous temporary file.
+ */
+struct spool {
+	uint8_t * buf;
+	size_t len;		/* Bytes held in buf. */
+	size_t size;		/* Allocated size of buf. */
+	size_t max;		/* Most bytes to hold in memory. */
+	FILE * tmp;		/* Temporary file, once buf would exceed max. */
+};
+
+/* Add len bytes from buf to the spool sp.  Return 0 or -1. */
+static int
+spool_write(struct spool * sp, const uint8_t * buf, size_t len)
+{
+	uint8_t * nbuf;
+	size_t nsize;
+
+	if (len == 0)
+		return (0);
+
+	/* Keep the data in memory while it fits. */
+	if ((sp->tmp == NULL) && (len <= sp->max - sp->len)) {
+		if (sp->len + len > sp->size) {
+			nsize = sp->size;
+			if (nsize == 0)
+				nsize = (sp->max < ENCBLOCK) ? sp->max : ENCBLOCK;
+			while (nsize < sp->len + len)
+				nsize = (nsize > sp->max / 2) ? sp->max :
+				    nsize * 2;
+			if ((nbuf = malloc(nsize)) == NULL)
+				return (-1);
+			memcpy(nbuf, sp->buf, sp->len);
+			if (sp->buf != NULL) {
+				memset(sp->buf, 0, sp->len);
+				free(sp->buf);
+			}
+			sp->buf = nbuf;
+			sp->size = nsize;
+		}
+		memcpy(&sp->buf[sp->len], buf, len);
+		sp->len += len;
+		return (0);
+	}
+
+	/* Otherwise move what we have to a temporary file, and go on there. */
+	if (sp->tmp == NULL) {
+		if ((sp->tmp = tmpfile()) == NULL)
+			return (-1);
+		if (fwrite(sp->buf, 1, sp->len, sp->tmp) < sp->len)
+			return (-1);
+		if (sp->buf != NULL) {
+			memset(sp->buf, 0, sp->len);
+			free(sp->buf);
+		}
+		sp->buf = NULL;
+		sp->len = sp->size = 0;
+	}
+	if (fwrite(buf, 1, len, sp->tmp) < len)
+		return (-1);
+
+	/* Success! */
+	return (0);
+}
+
+/*
+ * Copy the contents of the spool sp to outfile.  Data in a temporary file
+ * is moved within the kernel with copy_file_range(2) where possible.
+ * Return 0 or 12.
+ */
+static int
+spool_release(struct spool * sp, FILE * outfile)
+{
+	uint8_t * buf;
+	size_t len;
+	int rc = 0;
+
+	/* Data held in memory is simply written out. */
+	if (sp->tmp == NULL) {
+		if (fwrite(sp->buf, 1, sp->len, outfile) < sp->len)
+			return (12);
+		return (0);
+	}
+	if (fflush(sp->tmp))
+		return (12);
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	{
+		int64_t off = 0;
+		ssize_t n;
+
+		/*
+		 * Write whatever outfile has buffered, then move the data
+		 * straight from one descriptor to the other.  If the kernel
+		 * can't do that between these files (say, outfile is a pipe or
+		 * was opened for appending) before anything has been moved,
+		 * copy through a buffer instead.
+		 */
+		if (fflush(outfile))
+			return (12);
+		do {
+			n = syscall(SYS_copy_file_range, fileno(sp->tmp), &off,
+			    fileno(outfile), NULL, (size_t)1 << 30, 0);
+		} while ((n > 0) || ((n == -1) && (errno == EINTR)));
+		if (n == 0)
+			return (0);
+		if (off > 0)
+			return (12);
+	}
+#endif
+
+	/* Copy through a buffer. */
+	if ((buf = malloc(ENCBLOCK)) == NULL)
+		return (12);
+	rewind(sp->tmp);
+	while ((len = fread(buf, 1, ENCBLOCK, sp->tmp)) > 0) {
+		if (fwrite(buf, 1, len, outfile) < len) {
+			rc = 12;
+			break;
+		}
+	}
+	if (ferror(sp->tmp))
+		rc = 12;
+	memset(buf, 0, ENCBLOCK);
+	free(buf);
+
+	return (rc);
+}
+
+/* Zero and free the spool sp, and close its temporary file. */
+static void
+spool_free(struct spool * sp)
+{
+
+	if (sp->buf != NULL) {
+		memset(sp->buf, 0, sp->len);
+		free(sp->buf);
+	}
+	if (sp->tmp != NULL)
+		fclose(sp->tmp);
+}
+
+/*
+ * Write len bytes from buf to the spool sp or, if sp is NULL, to outfile.
+ * Return 0 or -1.
+ */
+static int
+outwrite(FILE * outfile, struct spool * sp, const uint8_t * buf, size_t len)
+{
+
+	if (sp != NULL)
+		return (spool_write(sp, buf, len));
+	if (fwrite(buf, 1, len, outfile) < len)
+		return (-1);
+	return (0);
+}
+
+/**
+ * scryptdec_file_seg(infile, outfile, sp, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt the version 1 data in infile as scryptdec_file, given the first
+ * 7 bytes of its header, writing to the spool sp if it is not NULL.
+ * Segments are read, opened and written out in batches, so that the
+ * threads used by seg_open_batch have work to share.
+ */
+static int
+scryptdec_file_seg(FILE * infile, FILE * outfile, struct spool * sp,
+    uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t dk[64];
+	uint8_t * key_enc = dk;
+	uint8_t * key_hmac = &dk[32];
+	HMAC_scrypt_SHA256_CTX hctx;
+	AES_KEY key_enc_exp;
+	uint8_t * inbuf;
+	uint8_t * outbuf;
+	size_t batchsegs;
+	size_t buflen;
+	size_t plainlen;
+	uint64_t firstseg = 0;
+	uint64_t nsegs;
+	int final;
+	int c;
+	int rc;
+
+	/* Read the rest of the header. */
+	if (fread(&header[7], 89, 1, infile) < 1) {
+		if (ferror(infile))
+			return (13);
+		else
+			return (7);
+	}
+
+	/* Parse the header and generate derived keys. */
+	if ((rc = scryptdec_setup(header, dk, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
+		return (rc);
+
+	/* Allocate buffers for a few segments per thread. */
+	batchsegs = SEG_BATCH * seg_threads();
+	if ((inbuf = malloc(batchsegs * (SEGSIZE + 32))) == NULL) {
+		rc = 6;
+		goto err0;
+	}
+	if ((outbuf = malloc(batchsegs * SEGSIZE)) == NULL) {
+		rc = 6;
+		goto err1;
+	}
+
+	/* Set up the cipher and the signature state shared by all segments. */
+	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp)) {
+		rc = 5;
+		goto err2;
+	}
+	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, header, 96);
+
+	do {
+		/* Read a batch of segments. */
+		buflen = fread(inbuf, 1, batchsegs * (SEGSIZE + 32), infile);
+		if (ferror(infile)) {
+			rc = 13;
+			goto err2;
+		}
+
+		/* If the batch is full, look ahead to see whether it's the end. */
+		final = 1;
+		if (buflen == batchsegs * (SEGSIZE + 32)) {
+			if ((c = getc(infile)) != EOF) {
+				ungetc(c, infile);
+				final = 0;
+			} else if (ferror(infile)) {
+				rc = 13;
+				goto err2;
+			}
+		}
+
+		/* Work out which segments we have. */
+		if (final) {
+			if (seg_layout(buflen, &nsegs, &plainlen)) {
+				rc = 7;
+				goto err2;
+			}
+		} else {
+			nsegs = batchsegs;
+			plainlen = batchsegs * SEGSIZE;
+		}
+
+		/* Verify and decrypt them, and write them out in order. */
+		if ((rc = seg_open_batch(inbuf, firstseg, nsegs,
+		    plainlen - (nsegs - 1) * SEGSIZE, final, &key_enc_exp,
+		    &hctx, outbuf)) != 0)
+			goto err2;
+		if (outwrite(outfile, sp, outbuf, plainlen)) {
+			rc = 12;
+			goto err2;
+		}
+		firstseg += nsegs;
+	} while (!final);
+
+err2:
+	memset(outbuf, 0, batchsegs * SEGSIZE);
+	free(outbuf);
+err1:
+	free(inbuf);
+err0:
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+	memset(&hctx, 0, sizeof(HMAC_scrypt_SHA256_CTX));
+
+	return (rc);
+}
+
+struct scryptenc_stream {
+	uint8_t dk[64];
+	AES_KEY key_enc_exp;
+	struct crypto_aesctr * AES;
+	HMAC_scrypt_SHA256_CTX hctx;
+};
+
+/**
+ * stream_init(header, dk):
+ * Allocate a stream which encrypts or decrypts data following the given
+ * header using the derived keys dk, and hash the header into its HMAC.
+ */
+static struct scryptenc_stream *
+stream_init(const uint8_t header[96], const uint8_t dk[64])
+{
+	struct scryptenc_stream * stream;
+	uint8_t * key_enc;
+	uint8_t * key_hmac;
+
+	/* Allocate memory. */
+	if ((stream = malloc(sizeof(struct scryptenc_stream))) == NULL)
+		goto err0;
+	memcpy(stream->dk, dk, 64);
+	key_enc = stream->dk;
+	key_hmac = &stream->dk[32];
+
+	/* Set up the cipher. */
+	if (AES_set_encrypt_key(key_enc, 256, &stream->key_enc_exp))
+		goto err1;
+	if ((stream->AES = crypto_aesctr_init(&stream->key_enc_exp, 0)) == NULL)
+		goto err1;
+
+	/* Start hashing with the header. */
+	HMAC_scrypt_SHA256_Init(&stream->hctx, key_hmac, 32);
+	HMAC_scrypt_SHA256_Update(&stream->hctx, header, 96);
+
+	/* Success! */
+	return (stream);
+
+err1:
+	memset(stream, 0, sizeof(struct scryptenc_stream));
+	free(stream);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Start encrypting a stream as scryptenc_stream_init does, using ep. */
+static int
+encstream_init(struct scryptenc_stream ** stream, uint8_t header[96],
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct encparams * ep)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = setup_enc(header, dk, 0, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ep)) != 0)
+		return (rc);
+
+	/* Set up the stream. */
+	*stream = stream_init(header, dk);
+	memset(dk, 0, 64);
+	if (*stream == NULL)
+		return (6);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * scryptenc_stream_init(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Pick parameters, derive keys and write a 96-byte header to header, and
+ * return via stream a state for encrypting the data which follows it.
+ */
+int
+scryptenc_stream_init(struct scryptenc_stream ** stream, uint8_t header[96],
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (encstream_init(stream, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptenc_stream_init_params(stream, header, passwd, passwdlen,
+ *     logN, r, p):
+ * Start encrypting a stream as scryptenc_stream_init does, but with the
+ * scrypt parameters N = 2^logN, r, and p instead of ones picked to fit
+ * memory and time limits.
+ */
+int
+scryptenc_stream_init_params(struct scryptenc_stream ** stream,
+    uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    int logN, uint32_t r, uint32_t p)
+{
+	struct encparams ep = { logN, r, p };
+
+	return (encstream_init(stream, header, passwd, passwdlen,
+	    0, 0, 0, &ep));
+}
+
+/**
+ * scryptdec_stream_init(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Parse the 96-byte header, derive keys and check the password, and return
+ * via stream a state for decrypting the data which follows it.
+ */
+int
+scryptdec_stream_init(struct scryptenc_stream ** stream,
+    const uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (scryptdec_stream_init_ceil(stream, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_stream_init_ceil(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Set up a stream as scryptdec_stream_init does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int
+scryptdec_stream_init_ceil(struct scryptenc_stream ** stream,
+    const uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Do we have the right magic? */
+	if (memcmp(header, "scrypt", 6))
+		return (7);
+	if (header[6] != 0)
+		return (8);
+
+	/* Parse the header and generate derived keys. */
+	if ((rc = scryptdec_setup(header, dk, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
+		return (rc);
+
+	/* Set up the stream. */
+	*stream = stream_init(header, dk);
+	memset(dk, 0, 64);
+	if (*stream == NULL)
+		return (6);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * scryptenc_stream_update(stream, inbuf, outbuf, buflen):
+ * Encrypt buflen bytes from inbuf into outbuf and add them to the HMAC.  If
+ * the buffers inbuf and outbuf overlap, they must be identical.
+ */
+void
+scryptenc_stream_update(struct scryptenc_stream * stream,
+    const uint8_t * inbuf, uint8_t * outbuf, size_t buflen)
+{
+
+	crypto_aesctr_stream(stream->AES, inbuf, outbuf, buflen);
+	HMAC_scrypt_SHA256_Update(&stream->hctx, outbuf, buflen);
+	metrics_encrypted(buflen);
+}
+
+/**
+ * scryptdec_stream_update(stream, inbuf, outbuf, buflen):
+ * Add buflen bytes from inbuf to the HMAC and decrypt them into outbuf.  If
+ * the buffers inbuf and outbuf overlap, they must be identical.
+ */
+void
+scryptdec_stream_update(struct scryptenc_stream * stream,
+    const uint8_t * inbuf, uint8_t * outbuf, size_t buflen)
+{
+
+	HMAC_scrypt_SHA256_Update(&stream->hctx, inbuf, buflen);
+	crypto_aesctr_stream(stream->AES, inbuf, outbuf, buflen);
+	metrics_decrypted(buflen);
+}
+
+/**
+ * scryptenc_stream_final(stream, sig):
+ * Write the 32-byte signature which ends the encrypted data to sig, and
+ * free the stream.
+ */
+void
+scryptenc_stream_final(struct scryptenc_stream * stream, uint8_t sig[32])
+{
+
+	HMAC_scrypt_SHA256_Final(sig, &stream->hctx);
+	scryptenc_stream_free(stream);
+}
+
+/**
+ * scryptdec_stream_final(stream, sig):
+ * Check the 32-byte signature sig which ends the encrypted data, and free
+ * the stream.  Return 0 if the signature is valid; or 7 if it is not.
+ */
+int
+scryptdec_stream_final(struct scryptenc_stream * stream, const uint8_t sig[32])
+{
+	uint8_t hbuf[32];
+	int rc;
+
+	HMAC_scrypt_SHA256_Final(hbuf, &stream->hctx);
+	rc = memcmp(hbuf, sig, 32) ? 7 : 0;
+	scryptenc_stream_free(stream);
+
+	return (rc);
+}
+
+/**
+ * scryptenc_stream_free(stream):
+ * Free a stream without finishing it.
+ */
+void
+scryptenc_stream_free(struct scryptenc_stream * stream)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (stream == NULL)
+		return;
+
+	/* Zero sensitive data. */
+	crypto_aesctr_free(stream->AES);
+	memset(stream, 0, sizeof(struct scryptenc_stream));
+	free(stream);
+}
+
+/*
+ * Sessions use a 96-byte header of format version 2, from which keys are
+ * derived once, and then protect any number of records with them.  Each
+ * record is an 8-byte big-endian nonce, the data encrypted with AES-CTR
+ * using that nonce, and an HMAC of the header, the nonce and the encrypted
+ * data.  The session which created the header numbers records 0, 1, 2, ...
+ * so that no nonce is used twice; a resumed session cannot know which
+ * nonces have been used, so it only opens records.
+ */
+struct scryptenc_session {
+	uint8_t dk[64];
+	AES_KEY key_enc_exp;
+	HMAC_scrypt_SHA256_CTX hctx;
+	uint64_t nonce;
+	int canseal;
+};
+
+/**
+ * session_init(header, dk, canseal):
+ * Allocate a session for the given header and derived keys, which may seal
+ * records if canseal is non-zero.  Return NULL on error.
+ */
+static struct scryptenc_session *
+session_init(const uint8_t header[96], const uint8_t dk[64], int canseal)
+{
+	struct scryptenc_session * session;
+
+	/* Allocate memory. */
+	if ((session = malloc(sizeof(struct scryptenc_session))) == NULL)
+		goto err0;
+	memcpy(session->dk, dk, 64);
+	session->nonce = 0;
+	session->canseal = canseal;
+
+	/* Set up the cipher. */
+	if (AES_set_encrypt_key(session->dk, 256, &session->key_enc_exp))
+		goto err1;
+
+	/* Every record signature starts with the header. */
+	HMAC_scrypt_SHA256_Init(&session->hctx, &session->dk[32], 32);
+	HMAC_scrypt_SHA256_Update(&session->hctx, header, 96);
+
+	/* Success! */
+	return (session);
+
+err1:
+	memset(session, 0, sizeof(struct scryptenc_session));
+	free(session);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * session_mac(session, record, ctlen, sig):
+ * Compute the signature of the record whose nonce and ctlen bytes of
+ * encrypted data are at record.
+ */
+static void
+session_mac(const struct scryptenc_session * session, const uint8_t * record,
+    size_t ctlen, uint8_t sig[32])
+{
+	HMAC_scrypt_SHA256_CTX hctx;
+
+	memcpy(&hctx, &session->hctx, sizeof(HMAC_scrypt_SHA256_CTX));
+	HMAC_scrypt_SHA256_Update(&hctx, record, 8 + ctlen);
+	HMAC_scrypt_SHA256_Final(sig, &hctx);
+}
+
+/* Start a new session as scryptenc_session_init does, using ep. */
+static int
+encsession_init(struct scryptenc_session ** session,
+    uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct encparams * ep)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = setup_enc(header, dk, 2, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ep)) != 0)
+		return (rc);
+
+	if ((*session = session_init(header, dk, 1)) == NULL)
+		rc = 6;
+
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+
+	return (rc);
+}
+
+/**
+ * scryptenc_session_init(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Start a new session, picking parameters and a salt as scryptenc_buf does
+ * and writing the 96-byte header to header.  Return 0 or an error code.
+ */
+int
+scryptenc_session_init(struct scryptenc_session ** session,
+    uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (encsession_init(session, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptenc_session_init_params(session, header, passwd, passwdlen,
+ *     logN, r, p):
+ * Start a new session as scryptenc_session_init does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int
+scryptenc_session_init_params(struct scryptenc_session ** session,
+    uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    int logN, uint32_t r, uint32_t p)
+{
+	struct encparams ep = { logN, r, p };
+
+	return (encsession_init(session, header, passwd, passwdlen,
+	    0, 0, 0, &ep));
+}
+
+/**
+ * scryptdec_session_init(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Resume the session whose 96-byte header is header, checking the password
+ * and limits as scryptdec_buf does.  The resumed session can only open
+ * records.  Return 0 or an error code.
+ */
+int
+scryptdec_session_init(struct scryptenc_session ** session,
+    const uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (scryptdec_session_init_ceil(session, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_session_init_ceil(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Resume a session as scryptdec_session_init does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int
+scryptdec_session_init_ceil(struct scryptenc_session ** session,
+    const uint8_t header[96], const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t dk[64];
+	int rc;
+
+	/* Check the magic and the format. */
+	if (memcmp(header, "scrypt", 6) != 0)
+		return (7);
+	if (header[6] != 2)
+		return (8);
+
+	/* Parse the header and generate derived keys. */
+	if ((rc = scryptdec_setup(header, dk, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) != 0)
+		return (rc);
+
+	if ((*session = session_init(header, dk, 0)) == NULL)
+		rc = 6;
+
+	/* Zero sensitive data. */
+	memset(dk, 0, 64);
+
+	return (rc);
+}
+
+/**
+ * scryptenc_session_seal(session, inbuf, inbuflen, outbuf):
+ * Encrypt and sign inbuflen bytes from inbuf as the next record of the
+ * session, writing inbuflen + 40 bytes to outbuf.  Return 0 or an error
+ * code; sessions resumed by scryptdec_session_init fail with 8.
+ */
+int
+scryptenc_session_seal(struct scryptenc_session * session,
+    const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf)
+{
+	struct crypto_aesctr * AES;
+
+	/* Only the session which started at nonce 0 knows what's unused. */
+	if (!session->canseal)
+		return (8);
+
+	/* Encrypt under a nonce which has not been used before. */
+	be64enc(outbuf, session->nonce);
+	if ((AES = crypto_aesctr_init(&session->key_enc_exp,
+	    session->nonce)) == NULL)
+		return (6);
+	session->nonce++;
+	crypto_aesctr_stream(AES, inbuf, &outbuf[8], inbuflen);
+	crypto_aesctr_free(AES);
+	metrics_encrypted(inbuflen);
+
+	/* Sign the nonce and the encrypted data. */
+	session_mac(session, outbuf, inbuflen, &outbuf[8 + inbuflen]);
+
+	return (0);
+}
+
+/**
+ * scryptdec_session_open(session, inbuf, inbuflen, outbuf, outlen):
+ * Verify and decrypt the record inbuf of the session, writing the data to
+ * outbuf and its length to outlen.  The allocated length of outbuf must be
+ * at least inbuflen.  Return 0 or an error code.  Records are not checked
+ * for being replayed or reordered.
+ */
+int
+scryptdec_session_open(struct scryptenc_session * session,
+    const uint8_t * inbuf, size_t inbuflen, uint8_t * outbuf, size_t * outlen)
+{
+	struct crypto_aesctr * AES;
+	uint8_t hbuf[32];
+
+	/* We need at least a nonce and a signature. */
+	if (inbuflen < 40)
+		return (7);
+
+	/* Verify the signature before decrypting anything. */
+	session_mac(session, inbuf, inbuflen - 40, hbuf);
+	if (memcmp(hbuf, &inbuf[inbuflen - 32], 32))
+		return (7);
+
+	if ((AES = crypto_aesctr_init(&session->key_enc_exp,
+	    be64dec(inbuf))) == NULL)
+		return (6);
+	crypto_aesctr_stream(AES, &inbuf[8], outbuf, inbuflen - 40);
+	crypto_aesctr_free(AES);
+	metrics_decrypted(inbuflen - 40);
+	*outlen = inbuflen - 40;
+
+	return (0);
+}
+
+/**
+ * scryptenc_session_free(session):
+ * Zero and free the session.
+ */
+void
+scryptenc_session_free(struct scryptenc_session * session)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (session == NULL)
+		return;
+
+	/* Zero sensitive data. */
+	memset(session, 0, sizeof(struct scryptenc_session));
+	free(session);
+}
+
+/*
+ * The file API moves data through FPIPE_NBUFS buffers in a ring: a reader
+ * thread fills them from infile, the calling thread encrypts or decrypts
+ * them, and a writer thread drains them to outfile, so that I/O overlaps
+ * with AES-CTR and HMAC.  Each buffer has 32 bytes in front of the block
+ * so that, when decrypting, the 32 bytes held back from the previous block
+ * (which may turn out to be the signature) can be put ahead of it.
+ */
+static size_t fpipe_blocksize = 0;
+
+enum fpipe_state { FPIPE_EMPTY, FPIPE_READ, FPIPE_DONE };
+
+struct fpipe_buf {
+	uint8_t * data;		/* 32 bytes of room, then a block. */
+	size_t len;		/* Bytes read into data + 32; 0 at the end. */
+	size_t start;		/* Offset of the bytes to write. */
+	size_t outlen;		/* Number of bytes to write. */
+	enum fpipe_state state;
+};
+
+struct fpipe {
+	FILE * infile;
+	FILE * outfile;
+	struct spool * spool;	/* Write here instead, if not NULL. */
+	struct scryptenc_stream * stream;
+	int dec;
+	size_t blocksize;
+	struct fpipe_buf bufs[FPIPE_NBUFS];
+	uint8_t carry[32];	/* Bytes held back when decrypting. */
+	size_t carrylen;
+	int rerr;		/* Reading failed. */
+	int werr;		/* Writing failed. */
+	int abort;		/* Stop all threads. */
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+/* Read the next block into b. */
+static void
+fpipe_read(struct fpipe * fp, struct fpipe_buf * b)
+{
+
+	b->len = fread(&b->data[32], 1, fp->blocksize, fp->infile);
+	if ((b->len < fp->blocksize) && ferror(fp->infile))
+		fp->rerr = 1;
+}
+
+/* Encrypt or decrypt the block in b. */
+static void
+fpipe_process(struct fpipe * fp, struct fpipe_buf * b)
+{
+	size_t total;
+
+	if (!fp->dec) {
+		b->start = 32;
+		b->outlen = b->len;
+		scryptenc_stream_update(fp->stream, &b->data[32],
+		    &b->data[32], b->len);
+		return;
+	}
+
+	/* Put the bytes held back ahead of the block. */
+	b->start = 32 - fp->carrylen;
+	memcpy(&b->data[b->start], fp->carry, fp->carrylen);
+	total = fp->carrylen + b->len;
+
+	/* Decrypt all but the last 32 bytes, and hold those back. */
+	if (total > 32) {
+		b->outlen = total - 32;
+		scryptdec_stream_update(fp->stream, &b->data[b->start],
+		    &b->data[b->start], b->outlen);
+		memcpy(fp->carry, &b->data[b->start + b->outlen], 32);
+		fp->carrylen = 32;
+	} else {
+		b->outlen = 0;
+		memcpy(fp->carry, &b->data[b->start], total);
+		fp->carrylen = total;
+	}
+}
+
+/* Write out the processed bytes of b. */
+static void
+fpipe_write(struct fpipe * fp, struct fpipe_buf * b)
+{
+
+	if (outwrite(fp->outfile, fp->spool, &b->data[b->start], b->outlen))
+		fp->werr = 1;
+}
+
+#ifndef _WIN32
+/* Wait until buffer b is in state, or the pipeline is aborted. */
+static int
+fpipe_wait(struct fpipe * fp, struct fpipe_buf * b, enum fpipe_state state)
+{
+
+	pthread_mutex_lock(&fp->mutex);
+	while ((b->state != state) && !fp->abort)
+		pthread_cond_wait(&fp->cond, &fp->mutex);
+	pthread_mutex_unlock(&fp->mutex);
+	return (fp->abort);
+}
+
+/* Move buffer b to state, or abort the pipeline. */
+static void
+fpipe_post(struct fpipe * fp, struct fpipe_buf * b, enum fpipe_state state,
+    int abort)
+{
+
+	pthread_mutex_lock(&fp->mutex);
+	b->state = state;
+	if (abort)
+		fp->abort = 1;
+	pthread_cond_broadcast(&fp->cond);
+	pthread_mutex_unlock(&fp->mutex);
+}
+
+static void *
+fpipe_reader(void * cookie)
+{
+	struct fpipe * fp = cookie;
+	struct fpipe_buf * b;
+	size_t len;
+	size_t i;
+
+	for (i = 0; ; i++) {
+		b = &fp->bufs[i % FPIPE_NBUFS];
+		if (fpipe_wait(fp, b, FPIPE_EMPTY))
+			break;
+		fpipe_read(fp, b);
+		len = b->len;
+		fpipe_post(fp, b, FPIPE_READ, 0);
+		if (len == 0)
+			break;
+	}
+
+	return (NULL);
+}
+
+static void *
+fpipe_writer(void * cookie)
+{
+	struct fpipe * fp = cookie;
+	struct fpipe_buf * b;
+	size_t i;
+
+	for (i = 0; ; i++) {
+		b = &fp->bufs[i % FPIPE_NBUFS];
+		if (fpipe_wait(fp, b, FPIPE_DONE))
+			break;
+		if (b->len == 0)
+			break;
+		fpipe_write(fp, b);
+		fpipe_post(fp, b, FPIPE_EMPTY, fp->werr);
+		if (fp->werr)
+			break;
+	}
+
+	return (NULL);
+}
+
+/* Run the pipeline with a reader and a writer thread. */
+static int
+fpipe_threaded(struct fpipe * fp)
+{
+	pthread_t reader, writer;
+	struct fpipe_buf * b;
+	size_t len;
+	size_t i;
+
+	if (pthread_mutex_init(&fp->mutex, NULL))
+		goto err0;
+	if (pthread_cond_init(&fp->cond, NULL))
+		goto err1;
+	if (pthread_create(&reader, NULL, fpipe_reader, fp))
+		goto err2;
+	if (pthread_create(&writer, NULL, fpipe_writer, fp)) {
+		fpipe_post(fp, &fp->bufs[0], FPIPE_EMPTY, 1);
+		pthread_join(reader, NULL);
+		goto err2;
+	}
+
+	/*
+	 * Process blocks as they are read, until the end or an error.  Once a
+	 * buffer is posted it may be refilled, so take its length first.
+	 */
+	for (i = 0; ; i++) {
+		b = &fp->bufs[i % FPIPE_NBUFS];
+		if (fpipe_wait(fp, b, FPIPE_READ))
+			break;
+		len = b->len;
+		if (len > 0)
+			fpipe_process(fp, b);
+		fpipe_post(fp, b, FPIPE_DONE, 0);
+		if (len == 0)
+			break;
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	pthread_cond_destroy(&fp->cond);
+	pthread_mutex_destroy(&fp->mutex);
+
+	/* Success! */
+	return (0);
+
+err2:
+	pthread_cond_destroy(&fp->cond);
+err1:
+	pthread_mutex_destroy(&fp->mutex);
+err0:
+	/* Failure! */
+	return (-1);
+}
+#endif
+
+/*
+ * Encrypt (or, if dec is non-zero, decrypt) infile to outfile, or to the
+ * spool sp if it is not NULL, with stream.  Return 0, 12 or 13; when
+ * decrypting, return via sig the last 32 bytes read and via siglen how
+ * many there were.
+ */
+static int
+fpipe_run(FILE * infile, FILE * outfile, struct spool * sp,
+    struct scryptenc_stream * stream, int dec, uint8_t sig[32],
+    size_t * siglen)
+{
+	struct fpipe fp;
+	struct fpipe_buf * b;
+	size_t i;
+	int rc = 0;
+
+	memset(&fp, 0, sizeof(struct fpipe));
+	fp.infile = infile;
+	fp.outfile = outfile;
+	fp.spool = sp;
+	fp.stream = stream;
+	fp.dec = dec;
+	fp.blocksize = fpipe_blocksize ? fpipe_blocksize : ENCBLOCK;
+
+	/* Allocate the buffers, with room for a signature after each block. */
+	if (fp.blocksize > SIZE_MAX - 32)
+		return (6);
+	for (i = 0; i < FPIPE_NBUFS; i++) {
+		if ((fp.bufs[i].data = malloc(32 + fp.blocksize)) == NULL) {
+			rc = 6;
+			goto done;
+		}
+	}
+
+#ifndef _WIN32
+	if (fpipe_threaded(&fp) == 0)
+		goto finished;
+#endif
+
+	/* Without threads, read, process and write one block at a time. */
+	b = &fp.bufs[0];
+	do {
+		fpipe_read(&fp, b);
+		if (b->len == 0)
+			break;
+		fpipe_process(&fp, b);
+		fpipe_write(&fp, b);
+	} while (!fp.werr);
+
+#ifndef _WIN32
+finished:
+#endif
+	if (fp.werr)
+		rc = 12;
+	else if (fp.rerr)
+		rc = 13;
+	memcpy(sig, fp.carry, fp.carrylen);
+	*siglen = fp.carrylen;
+
+done:
+	for (i = 0; i < FPIPE_NBUFS; i++) {
+		if (fp.bufs[i].data != NULL) {
+			memset(fp.bufs[i].data, 0, 32 + fp.blocksize);
+			free(fp.bufs[i].data);
+		}
+	}
+	memset(fp.carry, 0, 32);
+
+	return (rc);
+}
+
+/**
+ * scryptenc_set_blocksize(blocksize):
+ * Read, process and write blocks of blocksize bytes in scryptenc_file and
+ * scryptdec_file, or 64 kiB if blocksize is 0.  Return 0; or -1 if
+ * blocksize is above SCRYPTENC_BLOCKSIZE_MAX.
+ */
+int
+scryptenc_set_blocksize(size_t blocksize)
+{
+
+	if (blocksize > SCRYPTENC_BLOCKSIZE_MAX)
+		return (-1);
+	fpipe_blocksize = blocksize;
+
+	/* Success! */
+	return (0);
+}
+
+/* Write header, then encrypt infile to outfile with stream. */
+static int
+encfile(FILE * infile, FILE * outfile, struct scryptenc_stream * stream,
+    const uint8_t header[96])
+{
+	uint8_t hbuf[32];
+	size_t hlen;
+	int rc;
+
+	/* Write the header. */
+	if (fwrite(header, 96, 1, outfile) != 1) {
+		scryptenc_stream_free(stream);
+		return (12);
+	}
+
+	/* Encrypt the data, hashing it as it is produced. */
+	if ((rc = fpipe_run(infile, outfile, NULL, stream, 0, hbuf,
+	    &hlen)) != 0) {
+		scryptenc_stream_free(stream);
+		return (rc);
+	}
+
+	/* Compute the final HMAC and output it. */
+	scryptenc_stream_final(stream, hbuf);
+	if (fwrite(hbuf, 32, 1, outfile) != 1)
+		return (12);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * scryptenc_file(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Read a stream from infile and encrypt it, writing the resulting stream to
+ * outfile.
+ */
+int
+scryptenc_file(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+	uint8_t header[96];
+	struct scryptenc_stream * stream;
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = scryptenc_stream_init(&stream, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime)) != 0)
+		return (rc);
+
+	return (encfile(infile, outfile, stream, header));
+}
+
+/**
+ * scryptenc_file_params(infile, outfile, passwd, passwdlen, logN, r, p):
+ * Encrypt infile to outfile as scryptenc_file does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int
+scryptenc_file_params(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen, int logN, uint32_t r,
+    uint32_t p)
+{
+	uint8_t header[96];
+	struct scryptenc_stream * stream;
+	int rc;
+
+	/* Generate the header and derived key. */
+	if ((rc = scryptenc_stream_init_params(&stream, header, passwd,
+	    passwdlen, logN, r, p)) != 0)
+		return (rc);
+
+	return (encfile(infile, outfile, stream, header));
+}
+
+/*
+ * Decrypt infile as scryptdec_file does, writing the plaintext to the spool
+ * sp if it is not NULL, or to outfile otherwise.
+ */
+static int
+decfile(FILE * infile, FILE * outfile, struct spool * sp,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+	uint8_t header[96];
+	uint8_t sig[32];
+	size_t siglen;
+	struct scryptenc_stream * stream;
+	int rc;
+
+	/*
+	 * Read the first 7 bytes of the file; all future version of scrypt
+	 * are guaranteed to have at least 7 bytes of header.
+	 */
+	if (fread(header, 7, 1, infile) < 1) {
+		if (ferror(infile))
+			return (13);
+		else
+			return (7);
+	}
+
+	/* Do we have the right magic? */
+	if (memcmp(header, "scrypt", 6))
+		return (7);
+	if (header[6] == 1)
+		return (scryptdec_file_seg(infile, outfile, sp, header,
+		    passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil));
+	if (header[6] != 0)
+		return (8);
+
+	/*
+	 * Read another 89 bytes of the file; version 0 of the srypt file
+	 * format has a 96-byte header.
 	 */
 	if (fread(&header[7], 89, 1, infile) < 1) {
 		if (ferror(infile))
@@ -570,64 +2576,454 @@ scryptdec_file(FILE * infile, FILE * outfile,
 	}
 
 	/* Parse the header and generate derived keys. */
-	if ((rc = scryptdec_setup(header, dk, passwd, passwdlen,
-	    maxmem, maxmemfrac, maxtime)) != 0)
+	if ((rc = scryptdec_stream_init_ceil(&stream, header, passwd,
+	    passwdlen, maxmem, maxmemfrac, maxtime, ceil)) != 0)
 		return (rc);
 
-	/* Start hashing with the header. */
-	HMAC_scrypt_SHA256_Init(&hctx, key_hmac, 32);
-	HMAC_scrypt_SHA256_Update(&hctx, header, 96);
-
 	/*
 	 * We don't know how long the encrypted data block is (we can't know,
 	 * since data can be streamed into 'scrypt enc') so we need to read
 	 * data and decrypt all of it except the final 32 bytes, then check
 	 * if that final 32 bytes is the correct signature.
 	 */
-	if (AES_set_encrypt_key(key_enc, 256, &key_enc_exp))
-		return (5);
-	if ((AES = crypto_aesctr_init(&key_enc_exp, 0)) == NULL)
-		return (6);
-	do {
-		/* Read data until we have more than 32 bytes of it. */
-		if ((readlen = fread(&buf[buflen], 1,
-		    ENCBLOCK + 32 - buflen, infile)) == 0)
-			break;
-		buflen += readlen;
-		if (buflen <= 32)
-			continue;
+	if ((rc = fpipe_run(infile, outfile, sp, stream, 1, sig,
+	    &siglen)) != 0) {
+		scryptenc_stream_free(stream);
+		return (rc);
+	}
 
-		/*
-		 * Decrypt, hash, and output everything except the last 32
-		 * bytes out of what we have in our buffer.
-		 */
-		HMAC_scrypt_SHA256_Update(&hctx, buf, buflen - 32);
-		crypto_aesctr_stream(AES, buf, buf, buflen - 32);
-		if (fwrite(buf, 1, buflen - 32, outfile) < buflen - 32)
-			return (12);
+	/* Did we read enough data that we *might* have a valid signature? */
+	if (siglen < 32) {
+		scryptenc_stream_free(stream);
+		return (7);
+	}
 
-		/* Move the last 32 bytes to the start of the buffer. */
-		memmove(buf, &buf[buflen - 32], 32);
-		buflen = 32;
-	} while (1);
-	crypto_aesctr_free(AES);
+	/* Verify signature. */
+	return (scryptdec_stream_final(stream, sig));
+}
+
+/**
+ * scryptdec_file(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Read a stream from infile and decrypt it, writing the resulting stream to
+ * outfile.
+ */
+int
+scryptdec_file(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (decfile(infile, outfile, NULL, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_file_ceil(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt infile to outfile as scryptdec_file does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int
+scryptdec_file_ceil(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+
+	return (decfile(infile, outfile, NULL, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil));
+}
+
+/**
+ * scryptdec_file_spool(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, spoolmax):
+ * Decrypt infile to outfile as scryptdec_file does, but write nothing to
+ * outfile until all of infile has been authenticated.  Up to spoolmax bytes
+ * of plaintext are held in memory meanwhile; anything more goes to an
+ * anonymous temporary file.
+ */
+int
+scryptdec_file_spool(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime, size_t spoolmax)
+{
+
+	return (scryptdec_file_spool_ceil(infile, outfile, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, spoolmax, NULL));
+}
+
+/**
+ * scryptdec_file_spool_ceil(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, spoolmax, ceil):
+ * Decrypt infile to outfile as scryptdec_file_spool does, checking the
+ * parameters as scryptdec_buf_ceil does.
+ */
+int
+scryptdec_file_spool_ceil(FILE * infile, FILE * outfile,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime, size_t spoolmax,
+    const struct scryptdec_ceilings * ceil)
+{
+	struct spool sp;
+	int rc;
+
+	memset(&sp, 0, sizeof(struct spool));
+	sp.max = spoolmax;
+
+	/* Decrypt into the spool, and release it once it's authenticated. */
+	if ((rc = decfile(infile, outfile, &sp, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ceil)) == 0)
+		rc = spool_release(&sp, outfile);
+	spool_free(&sp);
+
+	return (rc);
+}
+
+/*
+ * Local files are encrypted and decrypted through a mapping of the input
+ * and a mapping of an output file sized up front, so the data is never
+ * copied through stdio buffers.  Anything which cannot be mapped (pipes,
+ * empty files, and every file on systems without mmap) goes through
+ * scryptenc_file and scryptdec_file instead.
+ */
+
+/*
+ * Encrypt (or, if dec is non-zero, decrypt) inpath to outpath via stdio,
+ * encrypting with the parameters ep if it is not NULL, and decrypting with
+ * the ceilings ceil.
+ */
+static int
+pathfile(const char * inpath, const char * outpath, int dec,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct encparams * ep, const struct scryptdec_ceilings * ceil)
+{
+	FILE * infile;
+	FILE * outfile;
+	int rc;
 
-	/* Did we exit the loop due to a read error? */
-	if (ferror(infile))
+	if ((infile = fopen(inpath, "rb")) == NULL)
 		return (13);
+	if ((outfile = fopen(outpath, "wb")) == NULL) {
+		fclose(infile);
+		return (12);
+	}
 
-	/* Did we read enough data that we *might* have a valid signature? */
-	if (buflen < 32)
-		return (7);
+	if (dec)
+		rc = scryptdec_file_ceil(infile, outfile, passwd, passwdlen,
+		    maxmem, maxmemfrac, maxtime, ceil);
+	else if (ep != NULL)
+		rc = scryptenc_file_params(infile, outfile, passwd, passwdlen,
+		    ep->logN, ep->r, ep->p);
+	else
+		rc = scryptenc_file(infile, outfile, passwd, passwdlen,
+		    maxmem, maxmemfrac, maxtime);
+	if (fclose(outfile) && (rc == 0))
+		rc = 12;
+	fclose(infile);
+
+	/* Don't leave partial or unauthenticated output behind. */
+	if (rc)
+		remove(outpath);
+
+	return (rc);
+}
 
-	/* Verify signature. */
-	HMAC_scrypt_SHA256_Final(hbuf, &hctx);
-	if (memcmp(hbuf, buf, 32))
-		return (7);
+#ifndef _WIN32
+struct pathmap {
+	int fd;
+	uint8_t * p;
+	size_t len;
+};
 
-	/* Zero sensitive data. */
-	memset(dk, 0, 64);
-	memset(&key_enc_exp, 0, sizeof(AES_KEY));
+/*
+ * Open and map the file path for reading.  Return 0 on success; 13 if it
+ * cannot be opened; or -1 if it cannot be mapped.
+ */
+static int
+map_in(const char * path, struct pathmap * m)
+{
+	struct stat sb;
+
+	if ((m->fd = open(path, O_RDONLY)) == -1)
+		return (13);
+
+	/* Only non-empty regular files which fit in memory can be mapped. */
+	if (fstat(m->fd, &sb) || !S_ISREG(sb.st_mode) || (sb.st_size <= 0) ||
+	    ((uintmax_t)sb.st_size > SIZE_MAX - 128))
+		goto err0;
+	m->len = (size_t)sb.st_size;
+
+	if ((m->p = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, m->fd, 0)) ==
+	    MAP_FAILED)
+		goto err0;
+#ifdef MADV_SEQUENTIAL
+	madvise(m->p, m->len, MADV_SEQUENTIAL);
+#endif
+
+	/* Success! */
+	return (0);
+
+err0:
+	close(m->fd);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Unmap and close a file mapped by map_in. */
+static void
+unmap_in(struct pathmap * m)
+{
+
+	munmap(m->p, m->len);
+	close(m->fd);
+}
+
+/*
+ * Allocate len bytes for the empty file open as fd and map it for writing.
+ * Return 0 on success or 12 on failure, closing fd either way on failure.
+ */
+static int
+map_out(int fd, size_t len, struct pathmap * m)
+{
+
+	m->fd = fd;
+	m->len = len;
+
+	/*
+	 * Allocate the blocks now where we can: running out of space while
+	 * storing to the mapping would raise SIGBUS rather than fail.
+	 */
+#ifdef HAVE_POSIX_FALLOCATE
+	if (posix_fallocate(m->fd, 0, (off_t)len))
+		goto err0;
+#else
+	if (ftruncate(m->fd, (off_t)len))
+		goto err0;
+#endif
+
+	if ((m->p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    m->fd, 0)) == MAP_FAILED)
+		goto err0;
 
+	/* Success! */
 	return (0);
+
+err0:
+	close(m->fd);
+
+	/* Failure! */
+	return (12);
+}
+
+/*
+ * Unmap a file mapped by map_out, cut it to len bytes and close it.
+ * Return 0 on success or 12 on failure.
+ */
+static int
+unmap_out(struct pathmap * m, size_t len)
+{
+	int rc = 0;
+
+	if (munmap(m->p, m->len))
+		rc = 12;
+	if ((len < m->len) && ftruncate(m->fd, (off_t)len))
+		rc = 12;
+	if (close(m->fd))
+		rc = 12;
+
+	return (rc);
+}
+#endif
+
+/* Encrypt inpath to outpath as scryptenc_path does, using ep. */
+static int
+encpath(const char * inpath, const char * outpath,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct encparams * ep)
+{
+#ifndef _WIN32
+	uint8_t header[96];
+	struct pathmap in, out;
+	struct scryptenc_stream * stream;
+	int fd;
+	int rc;
+
+	/* Map the input, or go through stdio if we can't. */
+	if ((rc = map_in(inpath, &in)) == -1)
+		goto nomap;
+	if (rc)
+		return (rc);
+
+	/* Generate the header and derived key. */
+	if ((rc = encstream_init(&stream, header, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ep)) != 0)
+		goto err0;
+
+	/* Map an output file with room for the header and signature. */
+	if ((fd = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0666)) == -1) {
+		rc = 12;
+		scryptenc_stream_free(stream);
+		goto err0;
+	}
+	if ((rc = map_out(fd, in.len + 128, &out)) != 0) {
+		remove(outpath);
+		scryptenc_stream_free(stream);
+		goto err0;
+	}
+
+	/* Encrypt straight from one mapping into the other. */
+	memcpy(out.p, header, 96);
+	scryptenc_stream_update(stream, in.p, &out.p[96], in.len);
+	scryptenc_stream_final(stream, &out.p[96 + in.len]);
+
+	if ((rc = unmap_out(&out, in.len + 128)) != 0)
+		remove(outpath);
+
+err0:
+	unmap_in(&in);
+
+	return (rc);
+
+nomap:
+#endif
+	return (pathfile(inpath, outpath, 0, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, ep, NULL));
+}
+
+/**
+ * scryptenc_path(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Encrypt the file inpath to the file outpath as scryptenc_file does,
+ * mapping both files into memory where possible.  On failure, outpath is
+ * removed.
+ */
+int
+scryptenc_path(const char * inpath, const char * outpath,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (encpath(inpath, outpath, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptenc_path_params(inpath, outpath, passwd, passwdlen, logN, r, p):
+ * Encrypt the file inpath to the file outpath as scryptenc_path does, but
+ * with the scrypt parameters N = 2^logN, r, and p instead of ones picked to
+ * fit memory and time limits.
+ */
+int
+scryptenc_path_params(const char * inpath, const char * outpath,
+    const uint8_t * passwd, size_t passwdlen, int logN, uint32_t r,
+    uint32_t p)
+{
+	struct encparams ep = { logN, r, p };
+
+	return (encpath(inpath, outpath, passwd, passwdlen, 0, 0, 0, &ep));
+}
+
+/**
+ * scryptdec_path(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Decrypt the file inpath to the file outpath as scryptdec_file does,
+ * mapping both files into memory where possible.  The data is decrypted
+ * into a temporary file beside outpath, which is renamed to outpath only
+ * once it has been authenticated, so outpath never holds unauthenticated
+ * data; the file is created readable only by its owner.
+ */
+int
+scryptdec_path(const char * inpath, const char * outpath,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime)
+{
+
+	return (scryptdec_path_ceil(inpath, outpath, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL));
+}
+
+/**
+ * scryptdec_path_ceil(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt inpath to outpath as scryptdec_path does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int
+scryptdec_path_ceil(const char * inpath, const char * outpath,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    const struct scryptdec_ceilings * ceil)
+{
+#ifndef _WIN32
+	struct pathmap in, out;
+	FILE * infile;
+	FILE * outfile;
+	char * tmppath;
+	size_t outlen;
+	int fd;
+	int rc;
+
+	/* Create the temporary file. */
+	if ((tmppath = malloc(strlen(outpath) + 8)) == NULL)
+		return (6);
+	sprintf(tmppath, "%s.XXXXXX", outpath);
+	if ((fd = mkstemp(tmppath)) == -1) {
+		free(tmppath);
+		return (12);
+	}
+
+	/* Map the input, or go through stdio if we can't. */
+	if ((rc = map_in(inpath, &in)) == -1) {
+		if ((infile = fopen(inpath, "rb")) == NULL) {
+			close(fd);
+			rc = 13;
+		} else if ((outfile = fdopen(fd, "wb")) == NULL) {
+			fclose(infile);
+			close(fd);
+			rc = 12;
+		} else {
+			rc = scryptdec_file_ceil(infile, outfile, passwd,
+			    passwdlen, maxmem, maxmemfrac, maxtime, ceil);
+			if (fclose(outfile) && (rc == 0))
+				rc = 12;
+			fclose(infile);
+		}
+		goto done;
+	}
+	if (rc) {
+		close(fd);
+		goto done;
+	}
+
+	/* The data is never longer than what it was encrypted to. */
+	if ((rc = map_out(fd, in.len, &out)) != 0)
+		goto err0;
+
+	/* Decrypt either format straight from one mapping into the other. */
+	if ((rc = decbuf(in.p, in.len, out.p, &outlen, passwd,
+	    passwdlen, maxmem, maxmemfrac, maxtime, ceil)) != 0) {
+		unmap_out(&out, 0);
+		goto err0;
+	}
+	rc = unmap_out(&out, outlen);
+
+err0:
+	unmap_in(&in);
+done:
+	/* Move the data into place, or throw it away. */
+	if ((rc == 0) && rename(tmppath, outpath))
+		rc = 12;
+	if (rc)
+		unlink(tmppath);
+	free(tmppath);
+
+	return (rc);
+#else
+	return (pathfile(inpath, outpath, 1, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, NULL, ceil));
+#endif
 }
@@ -81,6 +81,17 @@
 int scryptenc_buf(const uint8_t *, size_t, uint8_t *,
     const uint8_t *, size_t, size_t, double, double);
 
+/**
+ * scryptenc_buf_params(inbuf, inbuflen, outbuf, passwd, passwdlen,
+ *     logN, r, p, segmented):
+ * Encrypt inbuflen bytes from inbuf as scryptenc_buf does, or as
+ * scryptenc_buf_seg does if segmented is non-zero, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.  No memory or CPU speed measurements are made.
+ */
+int scryptenc_buf_params(const uint8_t *, size_t, uint8_t *,
+    const uint8_t *, size_t, int, uint32_t, uint32_t, int);
+
 /**
  * scryptdec_buf(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
  *     maxmem, maxmemfrac, maxtime):
@@ -91,6 +102,124 @@ int scryptenc_buf(const uint8_t *, size_t, uint8_t *,
 int scryptdec_buf(const uint8_t *, size_t, uint8_t *, size_t *,
     const uint8_t *, size_t, size_t, double, double);
 
+/**
+ * scryptenc_inspect(inbuf, inbuflen, logN, r, p, salt):
+ * Parse the header of the encrypted data inbuf without deriving any keys,
+ * verifying its checksum, and store the scrypt parameters N = 2^logN, r,
+ * and p and the 32-byte salt.  Decrypting the data takes about 128 * r * N
+ * bytes of memory and 4 * N * r * p salsa20/8 operations.  Return 0 on
+ * success; 7 if inbuf does not start with a valid header; or 8 if its
+ * format is not recognized.
+ */
+int scryptenc_inspect(const uint8_t *, size_t, int *, uint32_t *,
+    uint32_t *, uint8_t[32]);
+
+/* Deterministic ceilings on the parameters of data to be decrypted. */
+struct scryptdec_ceilings {
+	uint64_t maxN;		/* Largest N; or 0 for no limit. */
+	uint64_t maxrp;		/* Largest r * p; or 0 for no limit. */
+	uint64_t maxbytes;	/* Most memory, in bytes; or 0 for no limit. */
+};
+
+/**
+ * scryptdec_buf_ceil(inbuf, inbuflen, outbuf, outlen, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt inbuflen bytes from inbuf as scryptdec_buf does, but refuse data
+ * whose parameters exceed the ceilings ceil, if it is not NULL.  Data which
+ * would need more than ceil->maxbytes bytes of memory (128 * r * N) is
+ * refused with error 9, and data with N above ceil->maxN or r * p above
+ * ceil->maxrp with error 10.  A ceiling of 0 is filled from the limits:
+ * without maxbytes, the memory limit from maxmem and maxmemfrac applies, and
+ * unless maxN and maxrp are both set, so does the time limit maxtime.  With
+ * all three ceilings set, the available memory and the speed of the CPU
+ * are never measured.
+ */
+int scryptdec_buf_ceil(const uint8_t *, size_t, uint8_t *, size_t *,
+    const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+/**
+ * scryptenc_buf_seg_len(inbuflen):
+ * Return the length of the output of scryptenc_buf_seg for inbuflen bytes
+ * of input.
+ */
+size_t scryptenc_buf_seg_len(size_t);
+
+/**
+ * scryptenc_buf_seg(inbuf, inbuflen, outbuf, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Encrypt inbuflen bytes from inbuf into the segmented format (version 1),
+ * writing the resulting scryptenc_buf_seg_len(inbuflen) bytes to outbuf.
+ * Data in this format is split into 64 kB segments which are authenticated
+ * separately, so that parts of it can be decrypted by scryptdec_buf_range
+ * and all of it can be decrypted by several threads at once.
+ * scryptdec_buf and scryptdec_file accept both formats.
+ */
+int scryptenc_buf_seg(const uint8_t *, size_t, uint8_t *,
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptdec_buf_range(inbuf, inbuflen, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime):
+ * Decrypt up to length bytes starting at offset of the data in the version 1
+ * block inbuf, writing them into outbuf and their number to outlen.  Only
+ * the segments holding the requested bytes are authenticated and
+ * decrypted.  The allocated length of outbuf must be at least length.
+ */
+int scryptdec_buf_range(const uint8_t *, size_t, uint64_t, size_t,
+    uint8_t *, size_t *, const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptdec_buf_range_ceil(inbuf, inbuflen, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt a range as scryptdec_buf_range does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int scryptdec_buf_range_ceil(const uint8_t *, size_t, uint64_t, size_t,
+    uint8_t *, size_t *, const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+/**
+ * scryptdec_fd_range(fd, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime):
+ * Decrypt a range of the version 1 block held in the file open as fd, as
+ * scryptdec_buf_range does.  Only the header and the segments holding the
+ * requested bytes are read, with positioned reads which leave the file
+ * offset alone; this is not supported on Windows.
+ */
+int scryptdec_fd_range(int, uint64_t, size_t, uint8_t *, size_t *,
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptdec_fd_range_ceil(fd, offset, length, outbuf, outlen,
+ *     passwd, passwdlen, maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt a range as scryptdec_fd_range does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int scryptdec_fd_range_ceil(int, uint64_t, size_t, uint8_t *, size_t *,
+    const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+/**
+ * scryptdec_set_threads(nthreads):
+ * Set the number of threads used to decrypt data in the segmented format.
+ * If nthreads is 0, use one thread per CPU.  The default is 0.
+ */
+void scryptdec_set_threads(int);
+
+/* Largest block size scryptenc_set_blocksize accepts. */
+#define SCRYPTENC_BLOCKSIZE_MAX	(64 * 1024 * 1024)
+
+/**
+ * scryptenc_set_blocksize(blocksize):
+ * Read, process and write blocks of blocksize bytes in scryptenc_file and
+ * scryptdec_file, or 64 kiB if blocksize is 0.  Reading and writing run in
+ * their own threads, overlapping with encryption and decryption.  Return 0;
+ * or -1, leaving the block size alone, if blocksize is above
+ * SCRYPTENC_BLOCKSIZE_MAX.
+ */
+int scryptenc_set_blocksize(size_t);
+
 /**
  * scryptenc_file(infile, outfile, passwd, passwdlen,
  *     maxmem, maxmemfrac, maxtime):
@@ -100,6 +229,15 @@ int scryptdec_buf(const uint8_t *, size_t, uint8_t *, size_t *,
 int scryptenc_file(FILE *, FILE *, const uint8_t *, size_t,
     size_t, double, double);
 
+/**
+ * scryptenc_file_params(infile, outfile, passwd, passwdlen, logN, r, p):
+ * Encrypt infile to outfile as scryptenc_file does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int scryptenc_file_params(FILE *, FILE *, const uint8_t *, size_t,
+    int, uint32_t, uint32_t);
+
 /**
  * scryptdec_file(infile, outfile, passwd, passwdlen,
  *     maxmem, maxmemfrac, maxtime):
@@ -109,4 +247,221 @@ int scryptenc_file(FILE *, FILE *, const uint8_t *, size_t,
 int scryptdec_file(FILE *, FILE *, const uint8_t *, size_t,
     size_t, double, double);
 
+/**
+ * scryptdec_file_ceil(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt infile to outfile as scryptdec_file does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int scryptdec_file_ceil(FILE *, FILE *, const uint8_t *, size_t,
+    size_t, double, double, const struct scryptdec_ceilings *);
+
+/**
+ * scryptdec_file_spool(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, spoolmax):
+ * Decrypt infile to outfile as scryptdec_file does, but write nothing to
+ * outfile until all of infile has been authenticated.  Up to spoolmax bytes
+ * of plaintext are held in memory meanwhile; anything more goes to an
+ * anonymous temporary file.
+ */
+int scryptdec_file_spool(FILE *, FILE *, const uint8_t *, size_t,
+    size_t, double, double, size_t);
+
+/**
+ * scryptdec_file_spool_ceil(infile, outfile, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, spoolmax, ceil):
+ * Decrypt infile to outfile as scryptdec_file_spool does, checking the
+ * parameters as scryptdec_buf_ceil does.
+ */
+int scryptdec_file_spool_ceil(FILE *, FILE *, const uint8_t *, size_t,
+    size_t, double, double, size_t, const struct scryptdec_ceilings *);
+
+/**
+ * scryptenc_path(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Encrypt the file inpath to the file outpath as scryptenc_file does,
+ * mapping both files into memory where possible.  On failure, outpath is
+ * removed.
+ */
+int scryptenc_path(const char *, const char *, const uint8_t *, size_t,
+    size_t, double, double);
+
+/**
+ * scryptenc_path_params(inpath, outpath, passwd, passwdlen, logN, r, p):
+ * Encrypt the file inpath to the file outpath as scryptenc_path does, but
+ * with the scrypt parameters N = 2^logN, r, and p instead of ones picked to
+ * fit memory and time limits.
+ */
+int scryptenc_path_params(const char *, const char *, const uint8_t *,
+    size_t, int, uint32_t, uint32_t);
+
+/**
+ * scryptdec_path(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Decrypt the file inpath to the file outpath as scryptdec_file does,
+ * mapping both files into memory where possible.  The data is decrypted
+ * into a temporary file beside outpath, which is renamed to outpath only
+ * once it has been authenticated, so outpath never holds unauthenticated
+ * data; the file is created readable only by its owner.
+ */
+int scryptdec_path(const char *, const char *, const uint8_t *, size_t,
+    size_t, double, double);
+
+/**
+ * scryptdec_path_ceil(inpath, outpath, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Decrypt inpath to outpath as scryptdec_path does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int scryptdec_path_ceil(const char *, const char *, const uint8_t *,
+    size_t, size_t, double, double, const struct scryptdec_ceilings *);
+
+/* Opaque state for encrypting or decrypting a stream incrementally. */
+struct scryptenc_stream;
+
+/**
+ * scryptenc_stream_init(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Pick parameters, derive keys and write a 96-byte header to header, and
+ * return via stream a state for encrypting the data which follows it.
+ */
+int scryptenc_stream_init(struct scryptenc_stream **, uint8_t[96],
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptenc_stream_init_params(stream, header, passwd, passwdlen,
+ *     logN, r, p):
+ * Start encrypting a stream as scryptenc_stream_init does, but with the
+ * scrypt parameters N = 2^logN, r, and p instead of ones picked to fit
+ * memory and time limits.
+ */
+int scryptenc_stream_init_params(struct scryptenc_stream **, uint8_t[96],
+    const uint8_t *, size_t, int, uint32_t, uint32_t);
+
+/**
+ * scryptdec_stream_init(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Parse the 96-byte header, derive keys and check the password, and return
+ * via stream a state for decrypting the data which follows it.
+ */
+int scryptdec_stream_init(struct scryptenc_stream **, const uint8_t[96],
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptdec_stream_init_ceil(stream, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Set up a stream as scryptdec_stream_init does, checking the parameters as
+ * scryptdec_buf_ceil does.
+ */
+int scryptdec_stream_init_ceil(struct scryptenc_stream **,
+    const uint8_t[96], const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+/**
+ * scryptenc_stream_update(stream, inbuf, outbuf, buflen):
+ * Encrypt buflen bytes from inbuf into outbuf and add them to the HMAC.  If
+ * the buffers inbuf and outbuf overlap, they must be identical.
+ */
+void scryptenc_stream_update(struct scryptenc_stream *, const uint8_t *,
+    uint8_t *, size_t);
+
+/**
+ * scryptdec_stream_update(stream, inbuf, outbuf, buflen):
+ * Add buflen bytes from inbuf to the HMAC and decrypt them into outbuf.  If
+ * the buffers inbuf and outbuf overlap, they must be identical.  The
+ * decrypted data is not authenticated until scryptdec_stream_final returns.
+ */
+void scryptdec_stream_update(struct scryptenc_stream *, const uint8_t *,
+    uint8_t *, size_t);
+
+/**
+ * scryptenc_stream_final(stream, sig):
+ * Write the 32-byte signature which ends the encrypted data to sig, and
+ * free the stream.
+ */
+void scryptenc_stream_final(struct scryptenc_stream *, uint8_t[32]);
+
+/**
+ * scryptdec_stream_final(stream, sig):
+ * Check the 32-byte signature sig which ends the encrypted data, and free
+ * the stream.  Return 0 if the signature is valid; or 7 if it is not.
+ */
+int scryptdec_stream_final(struct scryptenc_stream *, const uint8_t[32]);
+
+/**
+ * scryptenc_stream_free(stream):
+ * Free a stream without finishing it.
+ */
+void scryptenc_stream_free(struct scryptenc_stream *);
+
+/* Opaque state for protecting many records under one derived key. */
+struct scryptenc_session;
+
+/**
+ * scryptenc_session_init(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Start a new session, picking parameters and a salt as scryptenc_buf does
+ * and writing the 96-byte header to header.  The key derivation function is
+ * run once here; records are then sealed with a fresh nonce each.  Return 0
+ * or an error code.
+ */
+int scryptenc_session_init(struct scryptenc_session **, uint8_t[96],
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptenc_session_init_params(session, header, passwd, passwdlen,
+ *     logN, r, p):
+ * Start a new session as scryptenc_session_init does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int scryptenc_session_init_params(struct scryptenc_session **, uint8_t[96],
+    const uint8_t *, size_t, int, uint32_t, uint32_t);
+
+/**
+ * scryptdec_session_init(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime):
+ * Resume the session whose 96-byte header is header, checking the password
+ * and limits as scryptdec_buf does.  The resumed session can only open
+ * records, since it cannot know which nonces have been used.  Return 0 or
+ * an error code.
+ */
+int scryptdec_session_init(struct scryptenc_session **, const uint8_t[96],
+    const uint8_t *, size_t, size_t, double, double);
+
+/**
+ * scryptdec_session_init_ceil(session, header, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, ceil):
+ * Resume a session as scryptdec_session_init does, checking the parameters
+ * as scryptdec_buf_ceil does.
+ */
+int scryptdec_session_init_ceil(struct scryptenc_session **,
+    const uint8_t[96], const uint8_t *, size_t, size_t, double, double,
+    const struct scryptdec_ceilings *);
+
+/**
+ * scryptenc_session_seal(session, inbuf, inbuflen, outbuf):
+ * Encrypt and sign inbuflen bytes from inbuf as the next record of the
+ * session, writing inbuflen + 40 bytes to outbuf.  Return 0 or an error
+ * code; sessions resumed by scryptdec_session_init fail with 8.
+ */
+int scryptenc_session_seal(struct scryptenc_session *, const uint8_t *,
+    size_t, uint8_t *);
+
+/**
+ * scryptdec_session_open(session, inbuf, inbuflen, outbuf, outlen):
+ * Verify and decrypt the record inbuf of the session, writing the data to
+ * outbuf and its length to outlen.  The allocated length of outbuf must be
+ * at least inbuflen.  Return 0 or an error code.  Records are not checked
+ * for being replayed or reordered.
+ */
+int scryptdec_session_open(struct scryptenc_session *, const uint8_t *,
+    size_t, uint8_t *, size_t *);
+
+/**
+ * scryptenc_session_free(session):
+ * Zero and free the session.
+ */
+void scryptenc_session_free(struct scryptenc_session *);
+
 #endif /* !_SCRYPTENC_H_ */
@@ -0,0 +1,927 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "scrypt_platform.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+#endif
+
+#include "scryptenc.h"
+
+#include "scryptenc_batch.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#define BATCH_URING
+#endif
+
+/* Size of the blocks read, encrypted and written. */
+#define BATCH_BLOCK	65536
+
+/* Buffers per file: being read, waiting or being encrypted, being written. */
+#define BATCH_NBUFS	3
+
+/* Files open at once. */
+#define BATCH_NACTIVE	64
+
+/*
+ * Submission queue entries; more than enough for a read or write on every
+ * buffer of every open file, each file's signature, and the eventfd.
+ */
+#define BATCH_QDEPTH	512
+
+struct batch {
+	const char * const * inpaths;
+	const char * const * outpaths;
+	size_t nfiles;
+	const uint8_t * passwd;
+	size_t passwdlen;
+	size_t maxmem;
+	double maxmemfrac;
+	double maxtime;
+	int logN;		/* Explicit parameters, if non-zero. */
+	uint32_t r;
+	uint32_t p;
+	int * rcs;
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+	size_t next;		/* Next file to start. */
+	struct batch_file * todo;	/* Files waiting for a worker. */
+	struct batch_file * done;	/* Files handed back by the workers. */
+	int stop;		/* Workers should exit. */
+	int efd;		/* Workers wake the I/O thread through this. */
+};
+
+/* Encrypt file i of the batch with scryptenc_path or scryptenc_path_params. */
+static int
+batch_path(struct batch * B, size_t i)
+{
+
+	if (B->logN != 0)
+		return (scryptenc_path_params(B->inpaths[i], B->outpaths[i],
+		    B->passwd, B->passwdlen, B->logN, B->r, B->p));
+	return (scryptenc_path(B->inpaths[i], B->outpaths[i], B->passwd,
+	    B->passwdlen, B->maxmem, B->maxmemfrac, B->maxtime));
+}
+
+#ifndef _WIN32
+/* Without io_uring, each worker encrypts whole files with scryptenc_path. */
+static void *
+batch_worker_sync(void * cookie)
+{
+	struct batch * B = cookie;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&B->mutex);
+		i = B->next++;
+		pthread_mutex_unlock(&B->mutex);
+		if (i >= B->nfiles)
+			break;
+
+		B->rcs[i] = batch_path(B, i);
+	}
+
+	return (NULL);
+}
+#endif
+
+#ifdef BATCH_URING
+struct batch_buf {
+	struct batch_file * f;
+	uint8_t * data;
+	size_t len;		/* Bytes of data. */
+	size_t done;		/* Bytes written so far. */
+	uint64_t off;		/* Offset of the data in the plaintext. */
+	uint64_t seq;		/* Number of the block. */
+	enum {
+		BUF_FREE,
+		BUF_READING,
+		BUF_READ,
+		BUF_ENCRYPTING,
+		BUF_WRITING
+	} state;
+};
+
+struct batch_file {
+	size_t idx;
+	int active;		/* Started and not finished. */
+	int infd;
+	int outfd;
+	int created;		/* We created outpaths[idx]. */
+	struct scryptenc_stream * stream;
+	uint8_t header[96];
+	uint8_t sig[32];
+	struct batch_buf bufs[BATCH_NBUFS];
+	struct batch_buf sigbuf;
+	uint64_t readoff;	/* Plaintext bytes read so far. */
+	uint64_t nread;		/* Blocks read so far. */
+	uint64_t nenc;		/* Blocks handed to a worker so far. */
+	struct batch_buf * task;	/* Block for the worker to encrypt. */
+	int keyed;		/* The key has been derived. */
+	int eof;
+	int busy;		/* A worker has it. */
+	int inflight;		/* I/O requests in flight. */
+	int signed_;		/* The signature has been computed. */
+	int rc;
+	struct batch_file * next;
+};
+
+struct uring {
+	int fd;
+	unsigned entries;
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_ptr;
+	size_t sq_len;
+	void * cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+	unsigned tosubmit;
+};
+
+/* Set up ring with entries submission queue entries. */
+static int
+uring_init(struct uring * ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(struct uring));
+	memset(&p, 0, sizeof(struct io_uring_params));
+	if ((ring->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1)
+		goto err0;
+
+	/* We need IORING_OP_READ and IORING_OP_WRITE, added with this. */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS))
+		goto err1;
+	ring->entries = p.sq_entries;
+
+	/* Map the submission and completion rings. */
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = ring->sq_len;
+	}
+	if ((ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING)) ==
+	    MAP_FAILED)
+		goto err1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else if ((ring->cq_ptr = mmap(NULL, ring->cq_len,
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	    IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto err2;
+
+	/* Map the submission queue entries. */
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES)) ==
+	    MAP_FAILED)
+		goto err3;
+
+	ring->sq_head = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask =
+	    (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array =
+	    (unsigned *)((uint8_t *)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask =
+	    (unsigned *)((uint8_t *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_ptr +
+	    p.cq_off.cqes);
+
+	/* Success! */
+	return (0);
+
+err3:
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+err2:
+	munmap(ring->sq_ptr, ring->sq_len);
+err1:
+	close(ring->fd);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Tear down ring. */
+static void
+uring_done(struct uring * ring)
+{
+
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+}
+
+/*
+ * Submit the queued requests and, if wait is non-zero, wait for at least
+ * one to complete.
+ */
+static int
+uring_enter(struct uring * ring, int wait)
+{
+	int n;
+
+	do {
+		n = syscall(__NR_io_uring_enter, ring->fd, ring->tosubmit,
+		    wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while ((n == -1) && (errno == EINTR));
+	if (n == -1)
+		return (-1);
+	ring->tosubmit -= n;
+
+	return (0);
+}
+
+/* Queue a read or write of len bytes at off. */
+static int
+uring_rw(struct uring * ring, int op, int fd, void * buf, size_t len,
+    uint64_t off, void * cookie)
+{
+	struct io_uring_sqe * sqe;
+	unsigned tail, idx;
+
+	/* Make room if the submission queue is full. */
+	tail = *ring->sq_tail;
+	while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) ==
+	    ring->entries) {
+		if (uring_enter(ring, 0))
+			return (-1);
+	}
+
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = (uint64_t)(uintptr_t)cookie;
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->tosubmit++;
+
+	return (0);
+}
+
+/* Hand f to a worker. */
+static void
+batch_post(struct batch * B, struct batch_file * f)
+{
+
+	f->busy = 1;
+	pthread_mutex_lock(&B->mutex);
+	f->next = B->todo;
+	B->todo = f;
+	pthread_cond_signal(&B->cond);
+	pthread_mutex_unlock(&B->mutex);
+}
+
+/* Derive the key for f, or encrypt its next block, then hand it back. */
+static void *
+batch_worker(void * cookie)
+{
+	struct batch * B = cookie;
+	struct batch_file * f;
+	uint64_t one = 1;
+
+	for (;;) {
+		pthread_mutex_lock(&B->mutex);
+		while ((B->todo == NULL) && !B->stop)
+			pthread_cond_wait(&B->cond, &B->mutex);
+		if ((f = B->todo) == NULL) {
+			pthread_mutex_unlock(&B->mutex);
+			break;
+		}
+		B->todo = f->next;
+		pthread_mutex_unlock(&B->mutex);
+
+		/*
+		 * Only the stream and the task buffer are ours: the I/O thread
+		 * goes on reading and writing the other buffers meanwhile.
+		 */
+		if ((f->task == NULL) && (B->logN != 0)) {
+			f->rc = scryptenc_stream_init_params(&f->stream,
+			    f->header, B->passwd, B->passwdlen, B->logN,
+			    B->r, B->p);
+			f->keyed = 1;
+		} else if (f->task == NULL) {
+			f->rc = scryptenc_stream_init(&f->stream, f->header,
+			    B->passwd, B->passwdlen, B->maxmem,
+			    B->maxmemfrac, B->maxtime);
+			f->keyed = 1;
+		} else {
+			scryptenc_stream_update(f->stream, f->task->data,
+			    f->task->data, f->task->len);
+		}
+
+		pthread_mutex_lock(&B->mutex);
+		f->next = B->done;
+		B->done = f;
+		pthread_mutex_unlock(&B->mutex);
+		while ((write(B->efd, &one, 8) == -1) && (errno == EINTR))
+			continue;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Open the files for f and hand it to a worker to derive its key.  Return
+ * 0 on success, or non-zero if f failed and is already finished with.
+ */
+static int
+batch_start(struct batch * B, struct batch_file * f, size_t idx)
+{
+	size_t i;
+
+	f->idx = idx;
+	f->active = 1;
+	f->infd = -1;
+	f->outfd = -1;
+	f->created = 0;
+	f->stream = NULL;
+	f->task = NULL;
+	f->readoff = f->nread = f->nenc = 0;
+	f->keyed = f->eof = f->busy = f->inflight = f->signed_ = 0;
+	f->rc = 0;
+	for (i = 0; i < BATCH_NBUFS; i++)
+		f->bufs[i].state = BUF_FREE;
+
+	if ((f->infd = open(B->inpaths[idx], O_RDONLY | O_CLOEXEC)) == -1) {
+		f->rc = 13;
+		return (-1);
+	}
+	if ((f->outfd = open(B->outpaths[idx],
+	    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1) {
+		f->rc = 12;
+		return (-1);
+	}
+	f->created = 1;
+
+	/* The worker owns f until it hands it back. */
+	batch_post(B, f);
+
+	/* Success! */
+	return (0);
+}
+
+/*
+ * Move f along: start reading, encrypting or signing whatever is ready.
+ * Return non-zero once f is finished, successfully or not.
+ */
+static int
+batch_step(struct batch * B, struct uring * ring, struct batch_file * f)
+{
+	struct batch_buf * b;
+	struct batch_buf * next = NULL;
+	struct batch_buf * idlebuf = NULL;
+	int reading = 0;
+	int pending = 0;
+	size_t i;
+
+	/* A failed file is finished once nothing refers to it. */
+	if (f->rc)
+		return (!f->busy && (f->inflight == 0));
+
+	/*
+	 * Nothing to do until the key has been derived; no I/O is in flight
+	 * for f until then, so only the worker touches it.
+	 */
+	if (!f->keyed)
+		return (0);
+
+	for (i = 0; i < BATCH_NBUFS; i++) {
+		b = &f->bufs[i];
+		if (b->state == BUF_FREE)
+			idlebuf = b;
+		else if (b->state == BUF_READING)
+			reading = 1;
+		else if (b->state == BUF_READ) {
+			pending = 1;
+			if (b->seq == f->nenc)
+				next = b;
+		}
+	}
+
+	/* Read the next block. */
+	if (!f->eof && !reading && (idlebuf != NULL)) {
+		idlebuf->state = BUF_READING;
+		if (uring_rw(ring, IORING_OP_READ, f->infd, idlebuf->data,
+		    BATCH_BLOCK, f->readoff, idlebuf)) {
+			idlebuf->state = BUF_FREE;
+			f->rc = 13;
+			return (!f->busy && (f->inflight == 0));
+		}
+		f->inflight++;
+		reading = 1;
+	}
+
+	/* Encrypting runs one block at a time, in order. */
+	if (f->busy)
+		return (0);
+
+	/* Encrypt the next block. */
+	if (next != NULL) {
+		next->state = BUF_ENCRYPTING;
+		f->task = next;
+		f->nenc++;
+		batch_post(B, f);
+		return (0);
+	}
+
+	/* Sign once everything has been read and encrypted. */
+	if (f->eof && !reading && !pending && !f->signed_) {
+		scryptenc_stream_final(f->stream, f->sig);
+		f->stream = NULL;
+		f->signed_ = 1;
+		f->sigbuf.off = f->readoff;
+		f->sigbuf.done = 0;
+		f->sigbuf.state = BUF_WRITING;
+		if (uring_rw(ring, IORING_OP_WRITE, f->outfd, f->sig, 32,
+		    96 + f->readoff, &f->sigbuf)) {
+			f->sigbuf.state = BUF_FREE;
+			f->rc = 12;
+			return (f->inflight == 0);
+		}
+		f->inflight++;
+	}
+
+	/* We're done once the signature and everything else is written. */
+	return (f->signed_ && (f->inflight == 0));
+}
+
+/* Handle a worker handing f back. */
+static void
+batch_returned(struct uring * ring, struct batch_file * f)
+{
+	struct batch_buf * b = f->task;
+
+	f->busy = 0;
+	f->task = NULL;
+
+	/* The key was derived: write the header. */
+	if (b == NULL) {
+		if ((f->rc == 0) &&
+		    (pwrite(f->outfd, f->header, 96, 0) != 96))
+			f->rc = 12;
+		return;
+	}
+
+	/* A block was encrypted: write it. */
+	b->state = BUF_WRITING;
+	b->done = 0;
+	if (f->rc || uring_rw(ring, IORING_OP_WRITE, f->outfd, b->data,
+	    b->len, 96 + b->off, b)) {
+		b->state = BUF_FREE;
+		if (f->rc == 0)
+			f->rc = 12;
+		return;
+	}
+	f->inflight++;
+}
+
+/* Handle the completion of the read or write on b. */
+static void
+batch_completed(struct uring * ring, struct batch_buf * b, int res)
+{
+	struct batch_file * f = b->f;
+
+	f->inflight--;
+	if (b->state == BUF_READING) {
+		if (res < 0) {
+			f->rc = 13;
+			b->state = BUF_FREE;
+		} else if (res == 0) {
+			f->eof = 1;
+			b->state = BUF_FREE;
+		} else {
+			b->len = res;
+			b->off = f->readoff;
+			b->seq = f->nread++;
+			f->readoff += res;
+			b->state = BUF_READ;
+		}
+		return;
+	}
+
+	/* A write: resubmit the rest if it was short. */
+	if (res <= 0) {
+		f->rc = 12;
+		b->state = BUF_FREE;
+		return;
+	}
+	b->done += res;
+	if (b->done < b->len) {
+		if (uring_rw(ring, IORING_OP_WRITE, f->outfd, &b->data[b->done],
+		    b->len - b->done, 96 + b->off + b->done, b)) {
+			f->rc = 12;
+			b->state = BUF_FREE;
+			return;
+		}
+		f->inflight++;
+		return;
+	}
+	b->state = BUF_FREE;
+}
+
+/* Close the files of f, record its result and free its stream. */
+static void
+batch_finish(struct batch * B, struct batch_file * f)
+{
+
+	if (f->infd != -1)
+		close(f->infd);
+	if ((f->outfd != -1) && close(f->outfd) && (f->rc == 0))
+		f->rc = 12;
+	scryptenc_stream_free(f->stream);
+	f->stream = NULL;
+	f->active = 0;
+
+	/* Don't leave partial output behind. */
+	B->rcs[f->idx] = f->rc;
+	if (f->rc && f->created)
+		remove(B->outpaths[f->idx]);
+}
+
+/* Finish f if batch_step says it is done, and make its slot idle. */
+#define BATCH_STEP(B, ring, f, idle, nleft) do {			\
+	if (batch_step(B, ring, f)) {					\
+		batch_finish(B, f);					\
+		(nleft)--;						\
+		(f)->next = (idle);					\
+		(idle) = (f);						\
+	}								\
+} while (0)
+
+/*
+ * Encrypt the files of B with io_uring and nthreads workers.  Return 0
+ * once every file has a result; or -1 if io_uring is unavailable or broke,
+ * in which case the files from B->next on have not been started.
+ */
+static int
+batch_uring(struct batch * B, int nthreads)
+{
+	struct uring ring;
+	struct batch_file * files;
+	struct batch_file * idle = NULL;
+	struct batch_file * f;
+	struct batch_file * list;
+	struct io_uring_cqe * cqe;
+	struct batch_buf * b;
+	pthread_t * threads;
+	uint64_t evbuf;
+	unsigned head;
+	size_t nleft = B->nfiles;
+	size_t nactive;
+	size_t i, j;
+	int nstarted;
+	int broken = 0;
+	int leak = 0;
+
+	/* Set up the ring and the eventfd the workers wake us through. */
+	if (uring_init(&ring, BATCH_QDEPTH))
+		goto err0;
+	if ((B->efd = eventfd(0, EFD_CLOEXEC)) == -1)
+		goto err1;
+
+	/* Allocate the files we keep open at once, and their buffers. */
+	nactive = (B->nfiles < BATCH_NACTIVE) ? B->nfiles : BATCH_NACTIVE;
+	if ((files = calloc(nactive, sizeof(struct batch_file))) == NULL)
+		goto err2;
+	for (i = 0; i < nactive; i++) {
+		f = &files[i];
+		for (j = 0; j < BATCH_NBUFS; j++) {
+			f->bufs[j].f = f;
+			if ((f->bufs[j].data = malloc(BATCH_BLOCK)) == NULL)
+				goto err3;
+		}
+		f->sigbuf.f = f;
+		f->sigbuf.data = f->sig;
+		f->sigbuf.len = 32;
+		f->next = idle;
+		idle = f;
+	}
+
+	/* Start the workers. */
+	if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL)
+		goto err3;
+	for (nstarted = 0; nstarted < nthreads; nstarted++) {
+		if (pthread_create(&threads[nstarted], NULL, batch_worker, B))
+			break;
+	}
+	if (nstarted == 0)
+		goto err4;
+
+	/* Listen for the workers. */
+	if (uring_rw(&ring, IORING_OP_READ, B->efd, &evbuf, 8,
+	    (uint64_t)-1, NULL))
+		goto err5;
+
+	/* From here on, every file gets a result. */
+	while (nleft > 0) {
+		/* Start new files while there is room. */
+		while ((idle != NULL) && (B->next < B->nfiles)) {
+			f = idle;
+			idle = f->next;
+			if (batch_start(B, f, B->next++)) {
+				batch_finish(B, f);
+				nleft--;
+				f->next = idle;
+				idle = f;
+			}
+		}
+
+		/* Take back the files the workers have finished with. */
+		pthread_mutex_lock(&B->mutex);
+		list = B->done;
+		B->done = NULL;
+		pthread_mutex_unlock(&B->mutex);
+		while ((f = list) != NULL) {
+			list = f->next;
+			batch_returned(&ring, f);
+			BATCH_STEP(B, &ring, f, idle, nleft);
+		}
+		if (nleft == 0)
+			break;
+
+		/* Submit what we have queued and wait for something to finish. */
+		if (uring_enter(&ring, 1)) {
+			broken = 1;
+			break;
+		}
+
+		/* Handle the completions. */
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			head++;
+
+			/* Woken by a worker: listen again. */
+			if (cqe->user_data == 0) {
+				if (uring_rw(&ring, IORING_OP_READ, B->efd,
+				    &evbuf, 8, (uint64_t)-1, NULL))
+					broken = 1;
+				continue;
+			}
+
+			b = (struct batch_buf *)(uintptr_t)cqe->user_data;
+			f = b->f;
+			batch_completed(&ring, b, cqe->res);
+			BATCH_STEP(B, &ring, f, idle, nleft);
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		if (broken)
+			break;
+	}
+
+err5:
+	/* Stop the workers. */
+	pthread_mutex_lock(&B->mutex);
+	B->stop = 1;
+	pthread_cond_broadcast(&B->cond);
+	pthread_mutex_unlock(&B->mutex);
+	for (i = 0; i < (size_t)nstarted; i++)
+		pthread_join(threads[i], NULL);
+
+	/*
+	 * If the ring broke, fail every file which was started but not
+	 * finished, and leave the rest to the caller.  Reads and writes may
+	 * still be in flight, so leak their buffers rather than free memory
+	 * the kernel could still write to.
+	 */
+	if (broken) {
+		for (i = 0; i < nactive; i++) {
+			if (!files[i].active)
+				continue;
+			if (files[i].inflight)
+				leak = 1;
+			if (files[i].rc == 0)
+				files[i].rc = 12;
+			batch_finish(B, &files[i]);
+		}
+	}
+err4:
+	free(threads);
+err3:
+	for (i = 0; !leak && (i < nactive); i++) {
+		for (j = 0; j < BATCH_NBUFS; j++)
+			free(files[i].bufs[j].data);
+	}
+	if (!leak)
+		free(files);
+err2:
+	close(B->efd);
+err1:
+	uring_done(&ring);
+err0:
+	/* Either every file has a result, or those from B->next on are left. */
+	return ((nleft == 0) ? 0 : -1);
+}
+#endif
+
+/*
+ * Encrypt the files as scryptenc_file_batch does or, if logN is non-zero, as
+ * scryptenc_file_batch_params does.
+ */
+static int
+batch_run(const char * const * inpaths, const char * const * outpaths,
+    size_t nfiles, const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime,
+    int logN, uint32_t r, uint32_t p, int nthreads, int * rcs)
+{
+	struct batch B;
+#ifndef _WIN32
+	pthread_t * threads;
+	int nstarted = 0;
+#endif
+	size_t i;
+
+	/* Nothing to do? */
+	if (nfiles == 0)
+		return (0);
+
+	memset(&B, 0, sizeof(struct batch));
+	B.inpaths = inpaths;
+	B.outpaths = outpaths;
+	B.nfiles = nfiles;
+	B.passwd = passwd;
+	B.passwdlen = passwdlen;
+	B.maxtime = maxtime;
+	B.logN = logN;
+	B.r = r;
+	B.p = p;
+	B.rcs = rcs;
+	B.efd = -1;
+
+	/* Pick the number of workers, and split the memory between them. */
+#ifndef _WIN32
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (nthreads <= 0)
+		nthreads = 1;
+	if ((size_t)nthreads > nfiles)
+		nthreads = (int)nfiles;
+	if ((maxmemfrac > 0.5) || (maxmemfrac == 0.0))
+		maxmemfrac = 0.5;
+	B.maxmem = maxmem / nthreads;
+	B.maxmemfrac = maxmemfrac / nthreads;
+	if ((maxmem > 0) && (B.maxmem == 0))
+		B.maxmem = 1;
+
+	for (i = 0; i < nfiles; i++)
+		rcs[i] = 0;
+
+#ifndef _WIN32
+	pthread_mutex_init(&B.mutex, NULL);
+	pthread_cond_init(&B.cond, NULL);
+
+#ifdef BATCH_URING
+	if (batch_uring(&B, nthreads) == 0)
+		goto done;
+#endif
+
+	/*
+	 * Without io_uring, or for the files it never started, each worker
+	 * encrypts whole files.
+	 */
+	if ((threads = malloc(nthreads * sizeof(pthread_t))) != NULL) {
+		for (nstarted = 0; nstarted < nthreads; nstarted++) {
+			if (pthread_create(&threads[nstarted], NULL,
+			    batch_worker_sync, &B))
+				break;
+		}
+		for (i = 0; i < (size_t)nstarted; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+	}
+
+	/* If no workers could be started, do it ourselves. */
+	batch_worker_sync(&B);
+
+#ifdef BATCH_URING
+done:
+#endif
+	pthread_cond_destroy(&B.cond);
+	pthread_mutex_destroy(&B.mutex);
+#else
+	for (i = 0; i < nfiles; i++)
+		rcs[i] = batch_path(&B, i);
+#endif
+
+	/* Report the first failure, if any. */
+	for (i = 0; i < nfiles; i++) {
+		if (rcs[i])
+			return (rcs[i]);
+	}
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * scryptenc_file_batch(inpaths, outpaths, nfiles, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, nthreads, rcs):
+ * Encrypt each of the nfiles files inpaths[i] to outpaths[i] as
+ * scryptenc_path does, storing its return code in rcs[i].  Use nthreads
+ * worker threads, or one per CPU if nthreads is 0; since the workers may
+ * derive keys at the same time, each one is held to a 1/nthreads share of
+ * maxmem and maxmemfrac.  Return 0 if every file was encrypted, or the
+ * return code of the first file which was not.
+ */
+int
+scryptenc_file_batch(const char * const * inpaths,
+    const char * const * outpaths, size_t nfiles,
+    const uint8_t * passwd, size_t passwdlen,
+    size_t maxmem, double maxmemfrac, double maxtime, int nthreads,
+    int * rcs)
+{
+
+	return (batch_run(inpaths, outpaths, nfiles, passwd, passwdlen,
+	    maxmem, maxmemfrac, maxtime, 0, 0, 0, nthreads, rcs));
+}
+
+/**
+ * scryptenc_file_batch_params(inpaths, outpaths, nfiles, passwd, passwdlen,
+ *     logN, r, p, nthreads, rcs):
+ * Encrypt the files as scryptenc_file_batch does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int
+scryptenc_file_batch_params(const char * const * inpaths,
+    const char * const * outpaths, size_t nfiles,
+    const uint8_t * passwd, size_t passwdlen,
+    int logN, uint32_t r, uint32_t p, int nthreads, int * rcs)
+{
+	size_t i;
+
+	/* Zero means "pick" to batch_run, and is no valid log2(N) anyway. */
+	if (logN < 1) {
+		for (i = 0; i < nfiles; i++)
+			rcs[i] = 3;
+		return ((nfiles > 0) ? 3 : 0);
+	}
+
+	return (batch_run(inpaths, outpaths, nfiles, passwd, passwdlen,
+	    0, 0, 0, logN, r, p, nthreads, rcs));
+}
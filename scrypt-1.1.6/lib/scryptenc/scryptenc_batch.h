@@ -0,0 +1,64 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _SCRYPTENC_BATCH_H_
+#define _SCRYPTENC_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Encryption of many files at once.  Keys are derived and data encrypted by
+ * a small pool of worker threads, while the calling thread keeps reads and
+ * writes for many files in flight through io_uring on Linux kernels which
+ * support it.  Elsewhere, each worker encrypts one file at a time with
+ * blocking I/O.  Either way, every file gets its own salt and the output is
+ * the same as that of scryptenc_file.
+ */
+
+/**
+ * scryptenc_file_batch(inpaths, outpaths, nfiles, passwd, passwdlen,
+ *     maxmem, maxmemfrac, maxtime, nthreads, rcs):
+ * Encrypt each of the nfiles files inpaths[i] to outpaths[i] as
+ * scryptenc_path does, storing its return code in rcs[i].  Use nthreads
+ * worker threads, or one per CPU if nthreads is 0; since the workers may
+ * derive keys at the same time, each one is held to a 1/nthreads share of
+ * maxmem and maxmemfrac.  Return 0 if every file was encrypted, or the
+ * return code of the first file which was not.
+ */
+int scryptenc_file_batch(const char * const *, const char * const *, size_t,
+    const uint8_t *, size_t, size_t, double, double, int, int *);
+
+/**
+ * scryptenc_file_batch_params(inpaths, outpaths, nfiles, passwd, passwdlen,
+ *     logN, r, p, nthreads, rcs):
+ * Encrypt the files as scryptenc_file_batch does, but with the scrypt
+ * parameters N = 2^logN, r, and p instead of ones picked to fit memory and
+ * time limits.
+ */
+int scryptenc_file_batch_params(const char * const *, const char * const *,
+    size_t, const uint8_t *, size_t, int, uint32_t, uint32_t, int, int *);
+
+#endif /* !_SCRYPTENC_BATCH_H_ */
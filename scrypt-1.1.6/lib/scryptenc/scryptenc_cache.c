@@ -0,0 +1,368 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "scrypt_platform.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#include "entropy.h"
+#include "sha256.h"
+
+#include "scryptenc_cache.h"
+
+#ifndef _WIN32
+struct cache_entry {
+	uint8_t header[64];
+	uint8_t pwtag[32];
+	uint8_t dk[64];
+	double added;
+	double used;
+	int valid;
+};
+
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_entry * cache = NULL;
+static size_t cache_len = 0;
+static size_t cache_maplen;
+static double cache_ttl;
+
+/* Key used to compute password tags, chosen when the cache is enabled. */
+static uint8_t tagkey[32];
+
+static double now(void);
+static void pwtag(const uint8_t *, size_t, uint8_t[32]);
+static int expired(const struct cache_entry *, double);
+static struct cache_entry * find(const uint8_t[64], const uint8_t[32],
+    double);
+static void wipe(struct cache_entry *);
+static void release(void);
+
+/**
+ * now(void):
+ * Return the current time in seconds, preferably from a monotonic clock.
+ */
+static double
+now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (ts.tv_sec + ts.tv_nsec * 0.000000001);
+#endif
+	return ((double)time(NULL));
+}
+
+/**
+ * pwtag(passwd, passwdlen, tag):
+ * Compute the tag under which keys derived from passwd are cached.
+ */
+static void
+pwtag(const uint8_t * passwd, size_t passwdlen, uint8_t tag[32])
+{
+	HMAC_scrypt_SHA256_CTX hctx;
+
+	HMAC_scrypt_SHA256_Init(&hctx, tagkey, 32);
+	HMAC_scrypt_SHA256_Update(&hctx, passwd, passwdlen);
+	HMAC_scrypt_SHA256_Final(tag, &hctx);
+	memset(&hctx, 0, sizeof(HMAC_scrypt_SHA256_CTX));
+}
+
+/**
+ * expired(e, t):
+ * Return non-zero if the entry e is past its time to live at time t.
+ */
+static int
+expired(const struct cache_entry * e, double t)
+{
+
+	return ((cache_ttl > 0) && (t - e->added >= cache_ttl));
+}
+
+/**
+ * find(header, tag, t):
+ * Return the live entry for header and tag at time t, or NULL.
+ */
+static struct cache_entry *
+find(const uint8_t header[64], const uint8_t tag[32], double t)
+{
+	struct cache_entry * e;
+	size_t i;
+
+	for (i = 0; i < cache_len; i++) {
+		e = &cache[i];
+		if (!e->valid || memcmp(e->header, header, 64) ||
+		    memcmp(e->pwtag, tag, 32))
+			continue;
+		if (expired(e, t)) {
+			wipe(e);
+			continue;
+		}
+		return (e);
+	}
+
+	return (NULL);
+}
+
+/**
+ * wipe(e):
+ * Zero and invalidate the entry e.
+ */
+static void
+wipe(struct cache_entry * e)
+{
+	volatile uint8_t * p = (volatile uint8_t *)e;
+	size_t i;
+
+	/* Don't let the compiler skip zeroing memory it won't read again. */
+	for (i = 0; i < sizeof(struct cache_entry); i++)
+		p[i] = 0;
+}
+
+/**
+ * release(void):
+ * Zero and free the cache.  The caller must hold cache_mtx.
+ */
+static void
+release(void)
+{
+	size_t i;
+
+	if (cache == NULL)
+		return;
+
+	for (i = 0; i < cache_len; i++)
+		wipe(&cache[i]);
+	munlock(cache, cache_maplen);
+	munmap(cache, cache_maplen);
+	cache = NULL;
+	cache_len = 0;
+}
+#endif
+
+/**
+ * scryptenc_cache_enable(maxentries, ttl):
+ * Cache up to maxentries derived keys, each for at most ttl seconds after it
+ * was added, or indefinitely if ttl is 0.  If maxentries is 0, disable the
+ * cache.  Any cached keys are dropped.  Return 0 on success; or -1 on error,
+ * with errno set.
+ */
+int
+scryptenc_cache_enable(size_t maxentries, double ttl)
+{
+#ifndef _WIN32
+	void * p;
+	size_t maplen;
+	int saved_errno = 0;
+	int rc = 0;
+
+	pthread_mutex_lock(&cache_mtx);
+	release();
+
+	/* Are we just turning the cache off? */
+	if (maxentries == 0)
+		goto done;
+
+	/* Allocate whole pages so that nothing else shares their locks. */
+	if (maxentries > SIZE_MAX / sizeof(struct cache_entry)) {
+		saved_errno = ENOMEM;
+		rc = -1;
+		goto done;
+	}
+	maplen = maxentries * sizeof(struct cache_entry);
+	p = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		saved_errno = errno;
+		rc = -1;
+		goto done;
+	}
+
+	/* Keep the keys out of swap and, where possible, core dumps. */
+	if (mlock(p, maplen)) {
+		saved_errno = errno;
+		munmap(p, maplen);
+		rc = -1;
+		goto done;
+	}
+#ifdef MADV_DONTDUMP
+	madvise(p, maplen, MADV_DONTDUMP);
+#endif
+
+	/* Pick a fresh key for password tags. */
+	if (entropy_read(tagkey, 32)) {
+		saved_errno = EIO;
+		munlock(p, maplen);
+		munmap(p, maplen);
+		rc = -1;
+		goto done;
+	}
+
+	cache = p;
+	cache_len = maxentries;
+	cache_maplen = maplen;
+	cache_ttl = ttl;
+
+done:
+	pthread_mutex_unlock(&cache_mtx);
+	if (rc)
+		errno = saved_errno;
+	return (rc);
+#else
+	(void)ttl;
+
+	/* Not supported on this platform; disabling it is fine. */
+	if (maxentries == 0)
+		return (0);
+	errno = ENOSYS;
+	return (-1);
+#endif
+}
+
+/**
+ * scryptenc_cache_clear(void):
+ * Drop and zero all cached keys.
+ */
+void
+scryptenc_cache_clear(void)
+{
+#ifndef _WIN32
+	size_t i;
+
+	pthread_mutex_lock(&cache_mtx);
+	for (i = 0; i < cache_len; i++)
+		wipe(&cache[i]);
+	pthread_mutex_unlock(&cache_mtx);
+#endif
+}
+
+/**
+ * scryptenc_cache_lookup(header, passwd, passwdlen, dk):
+ * Look for the key derived from the password passwd under the first 64
+ * bytes of the header.  Return 0 and copy it into dk if found; or -1
+ * otherwise.
+ */
+int
+scryptenc_cache_lookup(const uint8_t header[64], const uint8_t * passwd,
+    size_t passwdlen, uint8_t dk[64])
+{
+#ifndef _WIN32
+	struct cache_entry * e;
+	uint8_t tag[32];
+	double t;
+	int rc = -1;
+
+	/* Don't bother hashing the password if the cache is off. */
+	if (cache == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&cache_mtx);
+	if (cache != NULL) {
+		pwtag(passwd, passwdlen, tag);
+		t = now();
+		if ((e = find(header, tag, t)) != NULL) {
+			memcpy(dk, e->dk, 64);
+			e->used = t;
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache_mtx);
+
+	return (rc);
+#else
+	(void)header;
+	(void)passwd;
+	(void)passwdlen;
+	(void)dk;
+
+	return (-1);
+#endif
+}
+
+/**
+ * scryptenc_cache_insert(header, passwd, passwdlen, dk):
+ * Remember dk as the key derived from the password passwd under the first
+ * 64 bytes of the header, evicting the least recently used key if the
+ * cache is full.
+ */
+void
+scryptenc_cache_insert(const uint8_t header[64], const uint8_t * passwd,
+    size_t passwdlen, const uint8_t dk[64])
+{
+#ifndef _WIN32
+	struct cache_entry * e;
+	uint8_t tag[32];
+	double t;
+	size_t i;
+
+	if (cache == NULL)
+		return;
+
+	pthread_mutex_lock(&cache_mtx);
+	if (cache == NULL)
+		goto done;
+	pwtag(passwd, passwdlen, tag);
+	t = now();
+
+	/* Someone else may have beaten us to it. */
+	if ((e = find(header, tag, t)) == NULL) {
+		/* Use a free slot if there is one, else the least recent. */
+		e = &cache[0];
+		for (i = 0; i < cache_len; i++) {
+			if (cache[i].valid && expired(&cache[i], t))
+				wipe(&cache[i]);
+			if (!cache[i].valid) {
+				e = &cache[i];
+				break;
+			}
+			if (cache[i].used < e->used)
+				e = &cache[i];
+		}
+		wipe(e);
+		memcpy(e->header, header, 64);
+		memcpy(e->pwtag, tag, 32);
+		memcpy(e->dk, dk, 64);
+		e->added = t;
+		e->valid = 1;
+	}
+	e->used = t;
+
+done:
+	pthread_mutex_unlock(&cache_mtx);
+#else
+	(void)header;
+	(void)passwd;
+	(void)passwdlen;
+	(void)dk;
+#endif
+}
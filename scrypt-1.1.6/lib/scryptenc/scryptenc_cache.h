@@ -0,0 +1,78 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _SCRYPTENC_CACHE_H_
+#define _SCRYPTENC_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An optional cache of the keys derived by scryptdec_*, so that decrypting
+ * data under a header which was seen before skips the key derivation.
+ * Entries are keyed by a header and an HMAC of the password under a random
+ * per-process key, live in memory locked with mlock(2) (where supported),
+ * and are zeroed when evicted.  The cache is disabled by default.
+ */
+
+/**
+ * scryptenc_cache_enable(maxentries, ttl):
+ * Cache up to maxentries derived keys, each for at most ttl seconds after it
+ * was added, or indefinitely if ttl is 0.  If maxentries is 0, disable the
+ * cache.  Any cached keys are dropped.  Return 0 on success; or -1 on error,
+ * with errno set.
+ */
+int scryptenc_cache_enable(size_t, double);
+
+/**
+ * scryptenc_cache_clear(void):
+ * Drop and zero all cached keys.
+ */
+void scryptenc_cache_clear(void);
+
+/*
+ * The lookup and insertion below are used by scryptdec_* and are not
+ * exported from libscrypt.
+ */
+
+/**
+ * scryptenc_cache_lookup(header, passwd, passwdlen, dk):
+ * Look for the key derived from the password passwd under the first 64
+ * bytes of the header.  Return 0 and copy it into dk if found; or -1
+ * otherwise.
+ */
+int scryptenc_cache_lookup(const uint8_t[64], const uint8_t *, size_t,
+    uint8_t[64]);
+
+/**
+ * scryptenc_cache_insert(header, passwd, passwdlen, dk):
+ * Remember dk as the key derived from the password passwd under the first
+ * 64 bytes of the header, evicting the least recently used key if the
+ * cache is full.
+ */
+void scryptenc_cache_insert(const uint8_t[64], const uint8_t *, size_t,
+    const uint8_t[64]);
+
+#endif /* !_SCRYPTENC_CACHE_H_ */
@@ -35,6 +35,9 @@
 #include <time.h>
 
 #include "crypto_scrypt.h"
+#include "metrics.h"
+#include "probes.h"
+#include "stats.h"
 
 #include "scryptenc_cpuperf.h"
 
@@ -128,13 +131,8 @@ getclockdiff(struct timespec * st, double * diffd)
 	return (0);
 }
 
-/**
- * scryptenc_cpuperf(opps):
- * Estimate the number of salsa20/8 cores which can be executed per second,
- * and return the value via opps.
- */
-int
-scryptenc_cpuperf(double * opps)
+static int
+cpuperf(double * opps)
 {
 	struct timespec st;
 	double resd, diffd;
@@ -190,3 +188,26 @@ scryptenc_cpuperf(double * opps)
 	*opps = i / diffd;
 	return (0);
 }
+
+/**
+ * scryptenc_cpuperf(opps):
+ * Estimate the number of salsa20/8 cores which can be executed per second,
+ * and return the value via opps.
+ */
+int
+scryptenc_cpuperf(double * opps)
+{
+	int rc;
+
+	SCRYPT_PROBE0(cpuperf__entry);
+
+	/* Keep the key derivations run here out of the statistics. */
+	metrics_calibration();
+	stats_calibrating = 1;
+	rc = cpuperf(opps);
+	stats_calibrating = 0;
+
+	SCRYPT_PROBE2(cpuperf__return, rc, (rc == 0) ? (uint64_t)(*opps) : 0);
+
+	return (rc);
+}
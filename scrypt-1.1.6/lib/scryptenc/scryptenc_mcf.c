@@ -0,0 +1,341 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "scrypt_platform.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "crypto_scrypt.h"
+#include "entropy.h"
+
+#include "scryptenc_mcf.h"
+
+/* Length of the "$7$" prefix plus the encoded N, r, and p. */
+#define PREFIXLEN 14
+
+/* Number of random bytes to use as salt, and length of their encoding. */
+#define SALTBYTES 32
+#define SALTLEN 43
+
+/* Maximum accepted length of a salt string when parsing. */
+#define SALTLEN_MAX 64
+
+/* Number of derived key bytes, and length of their encoding. */
+#define HASHBYTES 32
+#define HASHLEN 43
+
+static const char itoa64[64] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static int atoi64(char);
+static char * encode64_uint32(char *, uint32_t, int);
+static const char * decode64_uint32(uint32_t *, const char *, int);
+static char * encode64(char *, const uint8_t *, size_t);
+static int decode64(uint8_t *, size_t, const char *, size_t);
+static int parse(const char *, int *, uint32_t *, uint32_t *,
+    const char **, size_t *, const char **);
+static int compute(const uint8_t *, size_t, const char *, size_t,
+    int, uint32_t, uint32_t, uint8_t[HASHBYTES]);
+
+static int
+atoi64(char c)
+{
+	const char * ptr;
+
+	if (c == '\0')
+		return (-1);
+	if ((ptr = memchr(itoa64, c, sizeof(itoa64))) == NULL)
+		return (-1);
+	return ((int)(ptr - itoa64));
+}
+
+/**
+ * encode64_uint32(dst, src, srcbits):
+ * Encode the low srcbits bits of src into dst, six bits per character, and
+ * return a pointer to the end of the encoded data.
+ */
+static char *
+encode64_uint32(char * dst, uint32_t src, int srcbits)
+{
+	int bit;
+
+	for (bit = 0; bit < srcbits; bit += 6) {
+		*dst++ = itoa64[src & 0x3f];
+		src >>= 6;
+	}
+
+	return (dst);
+}
+
+/**
+ * decode64_uint32(dst, src, dstbits):
+ * Decode dstbits bits from src into dst, and return a pointer to the end of
+ * the encoded data or NULL if src contains an invalid character.
+ */
+static const char *
+decode64_uint32(uint32_t * dst, const char * src, int dstbits)
+{
+	uint32_t value = 0;
+	int bit;
+	int c;
+
+	for (bit = 0; bit < dstbits; bit += 6) {
+		if ((c = atoi64(*src++)) < 0)
+			return (NULL);
+		value |= (uint32_t)(c) << bit;
+	}
+
+	*dst = value;
+	return (src);
+}
+
+/**
+ * encode64(dst, src, srclen):
+ * Encode srclen bytes from src into dst, and return a pointer to the end of
+ * the encoded data.  Every three bytes are encoded as four characters; any
+ * trailing bytes use only as many characters as are needed.
+ */
+static char *
+encode64(char * dst, const uint8_t * src, size_t srclen)
+{
+	uint32_t value;
+	size_t i, j;
+
+	for (i = 0; i < srclen; i += 3) {
+		value = 0;
+		for (j = 0; (j < 3) && (i + j < srclen); j++)
+			value |= (uint32_t)(src[i + j]) << (8 * j);
+		dst = encode64_uint32(dst, value, (int)(8 * j));
+	}
+
+	return (dst);
+}
+
+/**
+ * decode64(dst, dstlen, src, srclen):
+ * Decode srclen characters from src, which must encode exactly dstlen
+ * bytes, into dst.  Return 0 on success; or -1 on error.
+ */
+static int
+decode64(uint8_t * dst, size_t dstlen, const char * src, size_t srclen)
+{
+	uint32_t value;
+	size_t i, j;
+
+	for (i = 0; i < dstlen; i += 3) {
+		j = (dstlen - i < 3) ? dstlen - i : 3;
+		if (srclen < (8 * j + 5) / 6)
+			return (-1);
+		if ((src = decode64_uint32(&value, src, (int)(8 * j))) == NULL)
+			return (-1);
+		srclen -= (8 * j + 5) / 6;
+		for (; j > 0; j--) {
+			*dst++ = value & 0xff;
+			value >>= 8;
+		}
+	}
+
+	/* We must have consumed the entire input. */
+	if (srclen != 0)
+		return (-1);
+
+	return (0);
+}
+
+/**
+ * parse(mcf, logN, r, p, salt, saltlen, hash):
+ * Split the encoded hash mcf into its parameters, salt, and encoded derived
+ * key.  Return 0, 7, or 8 as scryptenc_mcf_params.
+ */
+static int
+parse(const char * mcf, int * logN, uint32_t * r, uint32_t * p,
+    const char ** salt, size_t * saltlen, const char ** hash)
+{
+	const char * pos;
+	const char * end;
+
+	/* Is this a hash we know how to handle? */
+	if (strncmp(mcf, "$7$", 3) != 0)
+		return (8);
+
+	/* Parse N, r, and p. */
+	if ((*logN = atoi64(mcf[3])) < 1)
+		return (7);
+	if ((pos = decode64_uint32(r, &mcf[4], 30)) == NULL)
+		return (7);
+	if ((pos = decode64_uint32(p, pos, 30)) == NULL)
+		return (7);
+	if ((*r == 0) || (*p == 0) ||
+	    ((uint64_t)(*r) * (uint64_t)(*p) >= 0x40000000))
+		return (7);
+
+	/* The salt runs until the next '$'. */
+	if ((end = strchr(pos, '$')) == NULL)
+		return (7);
+	if ((size_t)(end - pos) > SALTLEN_MAX)
+		return (7);
+	*salt = pos;
+	*saltlen = (size_t)(end - pos);
+
+	/* The rest is the encoded derived key. */
+	*hash = end + 1;
+	if (strlen(*hash) != HASHLEN)
+		return (7);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * compute(passwd, passwdlen, salt, saltlen, logN, r, p, dk):
+ * Compute the derived key for a "$7$" hash.
+ */
+static int
+compute(const uint8_t * passwd, size_t passwdlen,
+    const char * salt, size_t saltlen, int logN, uint32_t r, uint32_t p,
+    uint8_t dk[HASHBYTES])
+{
+	uint64_t N = (uint64_t)(1) << logN;
+
+	if (crypto_scrypt(passwd, passwdlen, (const uint8_t *)salt, saltlen,
+	    N, r, p, dk, HASHBYTES))
+		return (3);
+
+	return (0);
+}
+
+/**
+ * scryptenc_mcf_hash(passwd, passwdlen, logN, r, p, mcf):
+ * Hash the provided password with a newly generated salt and the scrypt
+ * parameters N = 2^logN, r, and p, and write the result as a NUL-terminated
+ * string to mcf, which must be at least SCRYPTENC_MCF_MAXLEN bytes long.
+ * Return 0 or an error code as documented in scryptenc.h.
+ */
+int
+scryptenc_mcf_hash(const uint8_t * passwd, size_t passwdlen,
+    int logN, uint32_t r, uint32_t p, char * mcf)
+{
+	uint8_t saltbytes[SALTBYTES];
+	uint8_t dk[HASHBYTES];
+	char * salt;
+	char * pos;
+	int rc;
+
+	/* Sanity-check parameters. */
+	if ((logN < 1) || (logN > 63))
+		return (7);
+	if ((r == 0) || (p == 0) ||
+	    ((uint64_t)(r) * (uint64_t)(p) >= 0x40000000))
+		return (7);
+
+	/* Get some salt. */
+	if (entropy_read(saltbytes, SALTBYTES))
+		return (4);
+
+	/* Construct the prefix and salt. */
+	memcpy(mcf, "$7$", 3);
+	mcf[3] = itoa64[logN];
+	pos = encode64_uint32(&mcf[4], r, 30);
+	pos = encode64_uint32(pos, p, 30);
+	salt = pos;
+	pos = encode64(pos, saltbytes, SALTBYTES);
+
+	/* Generate the derived key. */
+	if ((rc = compute(passwd, passwdlen, salt, SALTLEN,
+	    logN, r, p, dk)) != 0)
+		return (rc);
+
+	/* Append the encoded derived key. */
+	*pos++ = '$';
+	pos = encode64(pos, dk, HASHBYTES);
+	*pos = '\0';
+
+	/* Zero sensitive data. */
+	memset(dk, 0, HASHBYTES);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * scryptenc_mcf_verify(passwd, passwdlen, mcf):
+ * Check whether the provided password matches the encoded hash mcf.  Return
+ * 0 if it does; 11 if it does not; or another error code as documented in
+ * scryptenc.h.
+ */
+int
+scryptenc_mcf_verify(const uint8_t * passwd, size_t passwdlen,
+    const char * mcf)
+{
+	uint8_t expected[HASHBYTES];
+	uint8_t dk[HASHBYTES];
+	const char * salt;
+	const char * hash;
+	size_t saltlen;
+	int logN;
+	uint32_t r;
+	uint32_t p;
+	uint8_t diff = 0;
+	size_t i;
+	int rc;
+
+	/* Parse the encoded hash. */
+	if ((rc = parse(mcf, &logN, &r, &p, &salt, &saltlen, &hash)) != 0)
+		return (rc);
+	if (decode64(expected, HASHBYTES, hash, HASHLEN))
+		return (7);
+
+	/* Generate the derived key. */
+	if ((rc = compute(passwd, passwdlen, salt, saltlen,
+	    logN, r, p, dk)) != 0)
+		return (rc);
+
+	/* Compare in constant time. */
+	for (i = 0; i < HASHBYTES; i++)
+		diff |= dk[i] ^ expected[i];
+
+	/* Zero sensitive data. */
+	memset(dk, 0, HASHBYTES);
+
+	return (diff ? 11 : 0);
+}
+
+/**
+ * scryptenc_mcf_params(mcf, logN, r, p):
+ * Parse the scrypt parameters out of the encoded hash mcf without computing
+ * anything.  Return 0 on success; 7 if mcf is malformed; or 8 if it is not
+ * a "$7$" hash.
+ */
+int
+scryptenc_mcf_params(const char * mcf, int * logN, uint32_t * r,
+    uint32_t * p)
+{
+	const char * salt;
+	const char * hash;
+	size_t saltlen;
+
+	return (parse(mcf, logN, r, p, &salt, &saltlen, &hash));
+}
@@ -0,0 +1,72 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _SCRYPTENC_MCF_H_
+#define _SCRYPTENC_MCF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Password hashes are stored in the "$7$" modular crypt format used by
+ * crypt(3) implementations of scrypt:
+ *     $7$ N r r r r r p p p p p salt $ hash
+ * where N is a single character encoding log2(N), r and p are encoded as
+ * 30-bit little-endian integers in five characters each, salt is a string
+ * of characters which is used as-is as the scrypt salt, and hash is the
+ * encoding of a 32-byte derived key.  All encodings use the crypt(3)
+ * alphabet "./0-9A-Za-z", least significant six bits first.
+ */
+
+/* Maximum length of an encoded hash, including the terminating NUL. */
+#define SCRYPTENC_MCF_MAXLEN 128
+
+/**
+ * scryptenc_mcf_hash(passwd, passwdlen, logN, r, p, mcf):
+ * Hash the provided password with a newly generated salt and the scrypt
+ * parameters N = 2^logN, r, and p, and write the result as a NUL-terminated
+ * string to mcf, which must be at least SCRYPTENC_MCF_MAXLEN bytes long.
+ * Return 0 or an error code as documented in scryptenc.h.
+ */
+int scryptenc_mcf_hash(const uint8_t *, size_t, int, uint32_t, uint32_t,
+    char *);
+
+/**
+ * scryptenc_mcf_verify(passwd, passwdlen, mcf):
+ * Check whether the provided password matches the encoded hash mcf.  Return
+ * 0 if it does; 11 if it does not; or another error code as documented in
+ * scryptenc.h.
+ */
+int scryptenc_mcf_verify(const uint8_t *, size_t, const char *);
+
+/**
+ * scryptenc_mcf_params(mcf, logN, r, p):
+ * Parse the scrypt parameters out of the encoded hash mcf without computing
+ * anything.  Return 0 on success; 7 if mcf is malformed; or 8 if it is not
+ * a "$7$" hash.
+ */
+int scryptenc_mcf_params(const char *, int *, uint32_t *, uint32_t *);
+
+#endif /* !_SCRYPTENC_MCF_H_ */
@@ -0,0 +1,261 @@
+/*-
+ * Copyright 2009 Colin Percival
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+#include "scrypt_platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <Wincrypt.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "entropy.h"
+
+#ifndef _WIN32
+/* Size of the per-thread pool, and the largest request served from it. */
+#define POOLSIZE 4096
+#define POOLREAD_MAX 256
+
+static int pool_enabled = 0;
+
+/* Incremented in the child process after every fork(). */
+static volatile unsigned int fork_generation = 1;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+static __thread struct {
+	uint8_t buf[POOLSIZE];
+	size_t avail;
+	unsigned int generation;
+} pool;
+
+static void atfork_child(void);
+static void atfork_register(void);
+#endif
+
+static int read_os(uint8_t *, size_t);
+
+#ifdef HAVE_GETRANDOM
+/**
+ * read_getrandom(buf, buflen):
+ * Fill buf using the getrandom(2) system call.  Return 0 on success; 1 if
+ * the kernel does not provide getrandom(2); or -1 on error.
+ */
+static int
+read_getrandom(uint8_t * buf, size_t buflen)
+{
+	ssize_t lenread;
+
+	/* Large requests may be satisfied in several pieces. */
+	while (buflen > 0) {
+		if ((lenread = getrandom(buf, buflen, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS)
+				return (1);
+			return (-1);
+		}
+
+		/* We're partly done. */
+		buf += lenread;
+		buflen -= lenread;
+	}
+
+	/* Success! */
+	return (0);
+}
+#endif
+
+#ifndef _WIN32
+/**
+ * read_urandom(buf, buflen):
+ * Fill buf with bytes read from /dev/urandom.  Return 0 on success; or -1
+ * on error.
+ */
+static int
+read_urandom(uint8_t * buf, size_t buflen)
+{
+	int fd;
+	ssize_t lenread;
+
+	/* Open /dev/urandom. */
+	if ((fd = open("/dev/urandom", O_RDONLY)) == -1)
+		goto err0;
+
+	/* Read bytes until we have filled the buffer. */
+	while (buflen > 0) {
+		if ((lenread = read(fd, buf, buflen)) == -1)
+			goto err1;
+
+		/* The random device should never EOF. */
+		if (lenread == 0)
+			goto err1;
+
+		/* We're partly done. */
+		buf += lenread;
+		buflen -= lenread;
+	}
+
+	/* Close the device. */
+	while (close(fd) == -1) {
+		if (errno != EINTR)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	close(fd);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static void
+atfork_child(void)
+{
+
+	/* Invalidate the pools inherited from the parent. */
+	fork_generation++;
+}
+
+static void
+atfork_register(void)
+{
+
+	pthread_atfork(NULL, NULL, atfork_child);
+}
+#endif
+
+/**
+ * read_os(buf, buflen):
+ * Fill buf with random bytes from the operating system.  Return 0 on
+ * success; or -1 on error.
+ */
+static int
+read_os(uint8_t * buf, size_t buflen)
+{
+#ifndef _WIN32
+#ifdef HAVE_GETRANDOM
+	int rc;
+
+	/* Prefer getrandom(2), which needs no file descriptor. */
+	if ((rc = read_getrandom(buf, buflen)) != 1)
+		return (rc);
+#endif
+
+	/* Fall back to /dev/urandom on older kernels. */
+	return (read_urandom(buf, buflen));
+#else
+	HCRYPTPROV context;
+
+	if (!CryptAcquireContext(&context, NULL, NULL, PROV_RSA_AES,
+	    CRYPT_VERIFYCONTEXT))
+		return (-1);
+
+	if (!CryptGenRandom(context, buflen, buf)) {
+		CryptReleaseContext(context, 0);
+		return (-1);
+	}
+
+	CryptReleaseContext(context, 0);
+
+	/* Success! */
+	return (0);
+#endif
+}
+
+/**
+ * entropy_read(buf, buflen):
+ * Fill the given buffer with random bytes provided by the operating system.
+ * Return 0 on success; or -1 on error.
+ */
+int
+entropy_read(uint8_t * buf, size_t buflen)
+{
+
+#ifndef _WIN32
+	/* Serve small requests from this thread's pool if it is enabled. */
+	if (pool_enabled && (buflen <= POOLREAD_MAX)) {
+		/* Don't hand out bytes which the other side of a fork has. */
+		if (pool.generation != fork_generation) {
+			memset(pool.buf, 0, POOLSIZE);
+			pool.avail = 0;
+			pool.generation = fork_generation;
+		}
+
+		/* Refill the pool if it cannot satisfy this request. */
+		if (pool.avail < buflen) {
+			if (read_os(pool.buf, POOLSIZE))
+				return (-1);
+			pool.avail = POOLSIZE;
+		}
+
+		/* Take bytes from the end of the pool and wipe them. */
+		pool.avail -= buflen;
+		memcpy(buf, &pool.buf[pool.avail], buflen);
+		memset(&pool.buf[pool.avail], 0, buflen);
+
+		/* Success! */
+		return (0);
+	}
+#endif
+
+	return (read_os(buf, buflen));
+}
+
+/**
+ * entropy_pool_enable(enable):
+ * If enable is non-zero, serve small requests to entropy_read from a buffer
+ * of random bytes which each thread refills from the operating system 4 kB
+ * at a time; otherwise go to the operating system on every call.  Bytes
+ * buffered before a fork() are never used after it.
+ */
+void
+entropy_pool_enable(int enable)
+{
+
+#ifndef _WIN32
+	if (enable)
+		pthread_once(&fork_once, atfork_register);
+	pool_enabled = enable;
+#else
+	(void)enable;
+#endif
+}
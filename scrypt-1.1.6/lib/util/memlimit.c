@@ -60,6 +60,7 @@
 #endif
 
 #include "memlimit.h"
+#include "probes.h"
 
 #ifdef HAVE_SYSCTL_HW_USERMEM
 static int
@@ -260,8 +261,8 @@ memlimit_windows(size_t * memlimit)
 }
 #endif
 
-int
-memtouse(size_t maxmem, double maxmemfrac, size_t * memlimit)
+static int
+getmemtouse(size_t maxmem, double maxmemfrac, size_t * memlimit)
 {
 	size_t sysctl_memlimit, sysinfo_memlimit, rlimit_memlimit;
 	size_t sysconf_memlimit;
@@ -341,3 +342,21 @@ memtouse(size_t maxmem, double maxmemfrac, size_t * memlimit)
 	*memlimit = memavail;
 	return (0);
 }
+
+/**
+ * memtouse(maxmem, maxmemfrac, memlimit):
+ * Examine the system and return via memlimit the amount of RAM which should
+ * be used -- the specified fraction of the available RAM, but no more than
+ * maxmem, and no less than 1MiB.
+ */
+int
+memtouse(size_t maxmem, double maxmemfrac, size_t * memlimit)
+{
+	int rc;
+
+	SCRYPT_PROBE1(memtouse__entry, maxmem);
+	rc = getmemtouse(maxmem, maxmemfrac, memlimit);
+	SCRYPT_PROBE2(memtouse__return, rc, (rc == 0) ? *memlimit : 0);
+
+	return (rc);
+}
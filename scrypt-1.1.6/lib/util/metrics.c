@@ -0,0 +1,266 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "scrypt_platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ADD(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+
+/*
+ * A latency histogram.  The key packs log2(N) into bits 0 to 5, r into bits
+ * 6 to 34 and p into bits 35 to 63; 0 marks a free slot.
+ */
+struct kdf_slot {
+	uint64_t key;
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t buckets[METRICS_NBUCKETS];
+};
+
+static uint64_t calls[METRICS_NAPIS][METRICS_NOUTCOMES];
+static uint64_t bytes_encrypted;
+static uint64_t bytes_decrypted;
+static int64_t vmem;
+static uint64_t calibrations;
+
+/* Slots for distinct (N, r, p), followed by one for all others. */
+static struct kdf_slot kdf_slots[METRICS_NKDF + 1];
+
+static const char * api_names[METRICS_NAPIS] = {
+	"encrypt",
+	"decrypt",
+	"decrypt_range",
+	"encrypt_stream",
+	"decrypt_stream",
+	"encrypt_file",
+	"decrypt_file",
+	"encrypt_files",
+	"hash",
+	"verify",
+	"mcf_hash",
+	"mcf_verify",
+	"encryptor",
+	"decryptor",
+	"session",
+	"session_encrypt",
+	"session_decrypt"
+};
+
+/**
+ * metrics_call(api, outcome):
+ * Count a call to api which returned the error code outcome.
+ */
+void
+metrics_call(int api, int outcome)
+{
+
+	if ((outcome < 0) || (outcome >= METRICS_NOUTCOMES))
+		outcome = 3;
+	ADD(calls[api][outcome], 1);
+}
+
+/**
+ * metrics_encrypted(len):
+ * Count len bytes of plaintext encrypted.
+ */
+void
+metrics_encrypted(size_t len)
+{
+
+	ADD(bytes_encrypted, len);
+}
+
+/**
+ * metrics_decrypted(len):
+ * Count len bytes of ciphertext decrypted.
+ */
+void
+metrics_decrypted(size_t len)
+{
+
+	ADD(bytes_decrypted, len);
+}
+
+/* Find or claim the slot for (N, r, p). */
+static struct kdf_slot *
+kdf_slot(uint64_t N, uint32_t r, uint32_t p)
+{
+	uint64_t key, cur;
+	int logN;
+	size_t i;
+
+	/* Parameters which do not fit in a key share the last slot. */
+	for (logN = 1; logN < 64; logN++) {
+		if (N == (uint64_t)(1) << logN)
+			break;
+	}
+	if ((logN == 64) || (r >= (1 << 29)) || (p >= (1 << 29)))
+		return (&kdf_slots[METRICS_NKDF]);
+	key = (uint64_t)(logN) | ((uint64_t)(r) << 6) | ((uint64_t)(p) << 35);
+
+	for (i = 0; i < METRICS_NKDF; i++) {
+		cur = LOAD(kdf_slots[i].key);
+		if (cur == 0) {
+			/* Claim the slot, unless another thread beat us. */
+			if (__atomic_compare_exchange_n(&kdf_slots[i].key,
+			    &cur, key, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return (&kdf_slots[i]);
+		}
+		if (cur == key)
+			return (&kdf_slots[i]);
+	}
+
+	/* All slots are taken. */
+	return (&kdf_slots[METRICS_NKDF]);
+}
+
+/**
+ * metrics_kdf(N, r, p, ns):
+ * Record a key derivation with parameters N, r and p which took ns
+ * nanoseconds.
+ */
+void
+metrics_kdf(uint64_t N, uint32_t r, uint32_t p, uint64_t ns)
+{
+	struct kdf_slot * slot = kdf_slot(N, r, p);
+	uint64_t ms = ns / 1000000;
+	int i;
+
+	/* Find the first bucket with ms < 2^i. */
+	for (i = 0; i < METRICS_NBUCKETS - 1; i++) {
+		if (ms < (uint64_t)(1) << i)
+			break;
+	}
+
+	ADD(slot->count, 1);
+	ADD(slot->sum_ns, ns);
+	ADD(slot->buckets[i], 1);
+}
+
+/**
+ * metrics_vmem(delta):
+ * Add delta bytes to the memory currently held in V.
+ */
+void
+metrics_vmem(int64_t delta)
+{
+
+	ADD(vmem, delta);
+}
+
+/**
+ * metrics_calibration(void):
+ * Count a run of scryptenc_cpuperf.
+ */
+void
+metrics_calibration(void)
+{
+
+	ADD(calibrations, 1);
+}
+
+/* Copy the counts of slot into k. */
+static void
+kdf_copy(struct metrics_kdf * k, struct kdf_slot * slot)
+{
+	int b;
+
+	k->count = LOAD(slot->count);
+	k->sum_ns = LOAD(slot->sum_ns);
+	for (b = 0; b < METRICS_NBUCKETS; b++)
+		k->buckets[b] = LOAD(slot->buckets[b]);
+}
+
+/**
+ * metrics_snapshot(m):
+ * Copy the current value of every counter into m.  The counters are read
+ * one by one, so m need not reflect a single point in time.
+ */
+void
+metrics_snapshot(struct metrics * m)
+{
+	struct metrics_kdf * k;
+	uint64_t key;
+	size_t i;
+	int api, outcome;
+
+	for (api = 0; api < METRICS_NAPIS; api++) {
+		for (outcome = 0; outcome < METRICS_NOUTCOMES; outcome++)
+			m->calls[api][outcome] = LOAD(calls[api][outcome]);
+	}
+	m->bytes_encrypted = LOAD(bytes_encrypted);
+	m->bytes_decrypted = LOAD(bytes_decrypted);
+	m->vmem = (uint64_t)(LOAD(vmem));
+	m->calibrations = LOAD(calibrations);
+
+	/* Copy the histograms in use, then the one for all others. */
+	m->nkdf = 0;
+	for (i = 0; i < METRICS_NKDF; i++) {
+		if ((key = LOAD(kdf_slots[i].key)) == 0)
+			break;
+		k = &m->kdf[m->nkdf++];
+		k->logN = (int)(key & 63);
+		k->r = (uint32_t)((key >> 6) & ((1 << 29) - 1));
+		k->p = (uint32_t)(key >> 35);
+		kdf_copy(k, &kdf_slots[i]);
+	}
+	if (LOAD(kdf_slots[METRICS_NKDF].count) != 0) {
+		k = &m->kdf[m->nkdf++];
+		k->logN = -1;
+		k->r = k->p = 0;
+		kdf_copy(k, &kdf_slots[METRICS_NKDF]);
+	}
+}
+
+/**
+ * metrics_api_name(api):
+ * Return the name of api, such as "decrypt_range".
+ */
+const char *
+metrics_api_name(int api)
+{
+
+	return (api_names[api]);
+}
+
+/**
+ * metrics_bucket_ms(i):
+ * Return the upper bound in milliseconds of latency bucket i, or 0 for the
+ * last bucket, which has none.
+ */
+uint64_t
+metrics_bucket_ms(int i)
+{
+
+	if (i >= METRICS_NBUCKETS - 1)
+		return (0);
+	return ((uint64_t)(1) << i);
+}
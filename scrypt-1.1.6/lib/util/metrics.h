@@ -0,0 +1,150 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Process-wide counters, updated with atomic operations and always on, for
+ * export to monitoring systems: calls by API and outcome, key derivation
+ * latency histograms by (N, r, p), bytes encrypted and decrypted, memory
+ * currently held in V, and calibration runs.
+ */
+
+/* APIs whose calls are counted. */
+enum metrics_api {
+	METRICS_ENCRYPT,
+	METRICS_DECRYPT,
+	METRICS_DECRYPT_RANGE,
+	METRICS_ENCRYPT_STREAM,
+	METRICS_DECRYPT_STREAM,
+	METRICS_ENCRYPT_FILE,
+	METRICS_DECRYPT_FILE,
+	METRICS_ENCRYPT_FILES,
+	METRICS_HASH,
+	METRICS_VERIFY,
+	METRICS_MCF_HASH,
+	METRICS_MCF_VERIFY,
+	METRICS_ENCRYPTOR,
+	METRICS_DECRYPTOR,
+	METRICS_SESSION,
+	METRICS_SESSION_ENCRYPT,
+	METRICS_SESSION_DECRYPT,
+	METRICS_NAPIS
+};
+
+/* Outcomes are the error codes 0 (success) to 13 of scryptenc. */
+#define METRICS_NOUTCOMES	14
+
+/* Number of distinct (N, r, p) with their own latency histogram. */
+#define METRICS_NKDF		32
+
+/*
+ * Latency buckets: bucket i < METRICS_NBUCKETS - 1 counts key derivations
+ * taking less than 2^i ms which no earlier bucket counts; the last bucket
+ * counts the rest.
+ */
+#define METRICS_NBUCKETS	16
+
+struct metrics_kdf {
+	int logN;		/* -1 for (N, r, p) without a slot of their own. */
+	uint32_t r;
+	uint32_t p;
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t buckets[METRICS_NBUCKETS];
+};
+
+struct metrics {
+	uint64_t calls[METRICS_NAPIS][METRICS_NOUTCOMES];
+	uint64_t bytes_encrypted;
+	uint64_t bytes_decrypted;
+	uint64_t vmem;
+	uint64_t calibrations;
+	size_t nkdf;
+	struct metrics_kdf kdf[METRICS_NKDF + 1];
+};
+
+/**
+ * metrics_call(api, outcome):
+ * Count a call to api which returned the error code outcome.
+ */
+void metrics_call(int, int);
+
+/**
+ * metrics_encrypted(len):
+ * Count len bytes of plaintext encrypted.
+ */
+void metrics_encrypted(size_t);
+
+/**
+ * metrics_decrypted(len):
+ * Count len bytes of ciphertext decrypted.
+ */
+void metrics_decrypted(size_t);
+
+/**
+ * metrics_kdf(N, r, p, ns):
+ * Record a key derivation with parameters N, r and p which took ns
+ * nanoseconds.
+ */
+void metrics_kdf(uint64_t, uint32_t, uint32_t, uint64_t);
+
+/**
+ * metrics_vmem(delta):
+ * Add delta bytes to the memory currently held in V.
+ */
+void metrics_vmem(int64_t);
+
+/**
+ * metrics_calibration(void):
+ * Count a run of scryptenc_cpuperf.
+ */
+void metrics_calibration(void);
+
+/**
+ * metrics_snapshot(m):
+ * Copy the current value of every counter into m.  The counters are read
+ * one by one, so m need not reflect a single point in time.
+ */
+void metrics_snapshot(struct metrics *);
+
+/**
+ * metrics_api_name(api):
+ * Return the name of api, such as "decrypt_range".
+ */
+const char * metrics_api_name(int);
+
+/**
+ * metrics_bucket_ms(i):
+ * Return the upper bound in milliseconds of latency bucket i, or 0 for the
+ * last bucket, which has none.
+ */
+uint64_t metrics_bucket_ms(int);
+
+#endif /* !_METRICS_H_ */
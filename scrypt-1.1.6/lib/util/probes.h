@@ -0,0 +1,57 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/*
+ * Static tracepoints for perf, bpftrace and systemtap, in the "scrypt"
+ * provider.  With <sys/sdt.h> available (HAVE_SYS_SDT_H) each probe is a
+ * single nop plus a note in the ELF file describing where its arguments
+ * live; without it, the probes compile to nothing.  Arguments must be
+ * integers or pointers.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SCRYPT_PROBE0(name) \
+	DTRACE_PROBE(scrypt, name)
+#define SCRYPT_PROBE1(name, a) \
+	DTRACE_PROBE1(scrypt, name, a)
+#define SCRYPT_PROBE2(name, a, b) \
+	DTRACE_PROBE2(scrypt, name, a, b)
+#define SCRYPT_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(scrypt, name, a, b, c)
+#define SCRYPT_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(scrypt, name, a, b, c, d)
+#else
+#define SCRYPT_PROBE0(name) do { } while (0)
+#define SCRYPT_PROBE1(name, a) do { } while (0)
+#define SCRYPT_PROBE2(name, a, b) do { } while (0)
+#define SCRYPT_PROBE3(name, a, b, c) do { } while (0)
+#define SCRYPT_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* !_PROBES_H_ */
@@ -0,0 +1,220 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/* RUSAGE_THREAD is only declared by glibc with _GNU_SOURCE. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "scrypt_platform.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "stats.h"
+
+volatile int stats_enabled = 0;
+__thread int stats_calibrating = 0;
+
+/* Statistics of the current thread, and of all threads. */
+static __thread struct stats last;
+static struct stats total;
+
+static const char * phase_names[STATS_NPHASES] = {
+	"calibrate",
+	"alloc",
+	"pbkdf2_in",
+	"smix_fill",
+	"smix_mix",
+	"pbkdf2_out",
+	"free",
+	"aesctr",
+	"hmac"
+};
+
+/**
+ * stats_enable(enable):
+ * Start recording statistics if enable is non-zero, or stop otherwise.
+ */
+void
+stats_enable(int enable)
+{
+
+	stats_enabled = enable;
+}
+
+/**
+ * stats_now(void):
+ * Return a monotonic time in nanoseconds.  It is never 0.
+ */
+uint64_t
+stats_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + 1);
+#endif
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000 + 1);
+}
+
+/**
+ * stats_record(phase, ns, bytes):
+ * Record that phase took ns nanoseconds and processed bytes bytes.
+ */
+void
+stats_record(int phase, uint64_t ns, uint64_t bytes)
+{
+
+	last.ns[phase] += ns;
+	last.bytes[phase] += bytes;
+	last.calls[phase] += 1;
+
+	__atomic_fetch_add(&total.ns[phase], ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&total.bytes[phase], bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&total.calls[phase], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_faults(minflt, majflt):
+ * Store the number of minor and major page faults taken by this thread so
+ * far, or by the whole process where per-thread counts are not available,
+ * or zeroes if they cannot be measured.
+ */
+void
+stats_faults(uint64_t * minflt, uint64_t * majflt)
+{
+#ifndef _WIN32
+	struct rusage ru;
+
+#ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+#else
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#endif
+		*minflt = ru.ru_minflt;
+		*majflt = ru.ru_majflt;
+		return;
+	}
+#endif
+	*minflt = *majflt = 0;
+}
+
+/**
+ * stats_record_faults(minflt, majflt):
+ * Record that minflt minor and majflt major page faults happened.
+ */
+void
+stats_record_faults(uint64_t minflt, uint64_t majflt)
+{
+
+	last.minflt += minflt;
+	last.majflt += majflt;
+
+	__atomic_fetch_add(&total.minflt, minflt, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&total.majflt, majflt, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_begin(void):
+ * Zero the statistics of the current thread.
+ */
+void
+stats_begin(void)
+{
+
+	memset(&last, 0, sizeof(struct stats));
+}
+
+/**
+ * stats_last(st):
+ * Copy the statistics recorded by the current thread since it last called
+ * stats_begin into st.
+ */
+void
+stats_last(struct stats * st)
+{
+
+	memcpy(st, &last, sizeof(struct stats));
+}
+
+/**
+ * stats_total(st):
+ * Copy the statistics recorded by all threads into st.
+ */
+void
+stats_total(struct stats * st)
+{
+	int i;
+
+	for (i = 0; i < STATS_NPHASES; i++) {
+		st->ns[i] = __atomic_load_n(&total.ns[i], __ATOMIC_RELAXED);
+		st->bytes[i] = __atomic_load_n(&total.bytes[i],
+		    __ATOMIC_RELAXED);
+		st->calls[i] = __atomic_load_n(&total.calls[i],
+		    __ATOMIC_RELAXED);
+	}
+	st->minflt = __atomic_load_n(&total.minflt, __ATOMIC_RELAXED);
+	st->majflt = __atomic_load_n(&total.majflt, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_reset(void):
+ * Zero the statistics recorded by all threads.
+ */
+void
+stats_reset(void)
+{
+	int i;
+
+	for (i = 0; i < STATS_NPHASES; i++) {
+		__atomic_store_n(&total.ns[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&total.bytes[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&total.calls[i], 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&total.minflt, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&total.majflt, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_phase_name(phase):
+ * Return the name of phase, such as "pbkdf2_in".
+ */
+const char *
+stats_phase_name(int phase)
+{
+
+	return (phase_names[phase]);
+}
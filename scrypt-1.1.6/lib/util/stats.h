@@ -0,0 +1,167 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+/*
+ * Optional per-phase timing of key derivation and encryption.  While
+ * enabled (see stats_enable), each phase records the nanoseconds spent in
+ * it, the bytes it processed and the number of times it ran, both for the
+ * current thread since it last called stats_begin and for the process as a
+ * whole.  Define SCRYPT_NO_STATS to compile the instrumentation out.
+ */
+
+/* Instrumented phases. */
+enum stats_phase {
+	STATS_CALIBRATE,	/* memtouse and scryptenc_cpuperf. */
+	STATS_ALLOC,		/* Allocating B, XY and V. */
+	STATS_PBKDF2_IN,	/* The PBKDF2 which fills B. */
+	STATS_SMIX_FILL,	/* The first loop of smix, which fills V. */
+	STATS_SMIX_MIX,		/* The second loop of smix, which reads V. */
+	STATS_PBKDF2_OUT,	/* The PBKDF2 which produces the key. */
+	STATS_FREE,		/* Freeing B, XY and V. */
+	STATS_AESCTR,		/* crypto_aesctr_stream. */
+	STATS_HMAC,		/* HMAC_scrypt_SHA256_Update, outside PBKDF2. */
+	STATS_NPHASES
+};
+
+struct stats {
+	uint64_t ns[STATS_NPHASES];
+	uint64_t bytes[STATS_NPHASES];
+	uint64_t calls[STATS_NPHASES];
+	uint64_t minflt;	/* Minor page faults during key derivation. */
+	uint64_t majflt;	/* Major page faults during key derivation. */
+};
+
+/* Non-zero while statistics are being recorded. */
+extern volatile int stats_enabled;
+
+/*
+ * Non-zero while the current thread is measuring the CPU speed; the key
+ * derivations it runs meanwhile are neither timed nor counted.
+ */
+extern __thread int stats_calibrating;
+
+/**
+ * stats_enable(enable):
+ * Start recording statistics if enable is non-zero, or stop otherwise.
+ */
+void stats_enable(int);
+
+/**
+ * stats_now(void):
+ * Return a monotonic time in nanoseconds.  It is never 0.
+ */
+uint64_t stats_now(void);
+
+/**
+ * stats_record(phase, ns, bytes):
+ * Record that phase took ns nanoseconds and processed bytes bytes.
+ */
+void stats_record(int, uint64_t, uint64_t);
+
+/**
+ * stats_faults(minflt, majflt):
+ * Store the number of minor and major page faults taken by this thread so
+ * far, or by the whole process where per-thread counts are not available,
+ * or zeroes if they cannot be measured.
+ */
+void stats_faults(uint64_t *, uint64_t *);
+
+/**
+ * stats_record_faults(minflt, majflt):
+ * Record that minflt minor and majflt major page faults happened.
+ */
+void stats_record_faults(uint64_t, uint64_t);
+
+/**
+ * stats_begin(void):
+ * Zero the statistics of the current thread.
+ */
+void stats_begin(void);
+
+/**
+ * stats_last(st):
+ * Copy the statistics recorded by the current thread since it last called
+ * stats_begin into st.
+ */
+void stats_last(struct stats *);
+
+/**
+ * stats_total(st):
+ * Copy the statistics recorded by all threads into st.
+ */
+void stats_total(struct stats *);
+
+/**
+ * stats_reset(void):
+ * Zero the statistics recorded by all threads.
+ */
+void stats_reset(void);
+
+/**
+ * stats_phase_name(phase):
+ * Return the name of phase, such as "pbkdf2_in".
+ */
+const char * stats_phase_name(int);
+
+/**
+ * stats_start(void):
+ * Return the time at which a phase starts, or 0 if statistics are off.
+ */
+static inline uint64_t
+stats_start(void)
+{
+
+#ifndef SCRYPT_NO_STATS
+	if (stats_enabled && !stats_calibrating)
+		return (stats_now());
+#endif
+	return (0);
+}
+
+/**
+ * stats_end(phase, t0, bytes):
+ * Record the end of phase, which processed bytes bytes, given the value
+ * stats_start returned when it started.
+ */
+static inline void
+stats_end(int phase, uint64_t t0, uint64_t bytes)
+{
+
+#ifndef SCRYPT_NO_STATS
+	if (t0 != 0)
+		stats_record(phase, stats_now() - t0, bytes);
+#else
+	(void)phase;
+	(void)t0;
+	(void)bytes;
+#endif
+}
+
+#endif /* !_STATS_H_ */
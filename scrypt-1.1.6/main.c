@@ -0,0 +1,415 @@
+/*-
+ * Copyright 2026 py-scrypt contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "scrypt_platform.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "scryptenc.h"
+#include "stats.h"
+#include "warn.h"
+
+/* Descriptions of the error codes returned by scryptenc and scryptdec. */
+static const char * errstrs[] = {
+	"success",
+	"getrlimit or sysctl(hw.usermem) failed",
+	"clock_getres or clock_gettime failed",
+	"error computing derived key",
+	"could not read salt from /dev/urandom",
+	"error in OpenSSL",
+	"malloc failed",
+	"input is not valid scrypt-encrypted block",
+	"unrecognized scrypt format",
+	"decrypting file would take too much memory",
+	"decrypting file would take too long",
+	"passphrase is incorrect",
+	"error writing output file",
+	"error reading input file"
+};
+
+static struct option longopts[] = {
+	{ "stats", no_argument, NULL, 's' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: scrypt {enc | dec} [-N n -r r -p p] [-t maxtime] [-m maxmem]\n"
+	    "              [-M maxmemfrac] [-T threads] [-b bufsize] [-k passfile]\n"
+	    "              [-S spool] [--stats] [infile [outfile]]\n");
+	exit(1);
+}
+
+/*
+ * Parse the argument of option ch as a non-negative integer no larger than
+ * max, or exit with an error; strtoull alone would take "-1" as a huge value
+ * and "x" as 0.
+ */
+static uint64_t
+getnum(int ch, const char * arg, uint64_t max)
+{
+	unsigned long long n;
+	char * end;
+
+	errno = 0;
+	n = strtoull(arg, &end, 0);
+	if (!isdigit((unsigned char)arg[0]) || (*end != '\0') ||
+	    (errno != 0) || (n > max)) {
+		warnx("-%c needs an integer from 0 to %llu: %s", ch,
+		    (unsigned long long)max, arg);
+		exit(1);
+	}
+	return ((uint64_t)n);
+}
+
+/*
+ * Parse the argument of option ch as a finite, non-negative number, or exit
+ * with an error; strtod alone would take "x" as 0, which for -t and -M means
+ * the weakest parameters.
+ */
+static double
+getfrac(int ch, const char * arg)
+{
+	double d;
+	char * end;
+
+	errno = 0;
+	d = strtod(arg, &end);
+	if (!(isdigit((unsigned char)arg[0]) || (arg[0] == '.')) ||
+	    (end == arg) || (*end != '\0') || (errno != 0) || !isfinite(d)) {
+		warnx("-%c needs a finite number of at least 0: %s", ch, arg);
+		exit(1);
+	}
+	return (d);
+}
+
+/* Zero and free a passphrase returned by getpassphrase. */
+static void
+freepassphrase(char * passwd)
+{
+
+	memset(passwd, 0, strlen(passwd));
+	free(passwd);
+}
+
+/*
+ * Read a passphrase from the first line of passfile, or ask for it; if
+ * confirm is non-zero, ask twice, since a mistyped passphrase would leave
+ * the output unrecoverable.
+ */
+static char *
+getpassphrase(const char * passfile, int confirm)
+{
+	FILE * f;
+	char buf[2048];
+	char * passwd;
+	char * again;
+
+	if (passfile == NULL) {
+		if ((passwd = getenv("SCRYPT_PASSPHRASE")) != NULL)
+			return (strdup(passwd));
+		if ((again = getpass("Please enter passphrase: ")) == NULL)
+			return (NULL);
+		passwd = strdup(again);
+		memset(again, 0, strlen(again));
+		if ((passwd == NULL) || !confirm)
+			return (passwd);
+		if ((again = getpass("Please confirm passphrase: ")) == NULL) {
+			freepassphrase(passwd);
+			return (NULL);
+		}
+		if (strcmp(passwd, again) != 0) {
+			warnx("Passphrases mismatch");
+			freepassphrase(passwd);
+			passwd = NULL;
+		}
+		memset(again, 0, strlen(again));
+		return (passwd);
+	}
+
+	if ((f = fopen(passfile, "r")) == NULL) {
+		warn("Cannot open passphrase file: %s", passfile);
+		return (NULL);
+	}
+	if (fgets(buf, sizeof(buf), f) == NULL)
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\r\n")] = '\0';
+	passwd = strdup(buf);
+	memset(buf, 0, sizeof(buf));
+	return (passwd);
+}
+
+/* Print what the --stats option promises, as JSON, to stderr. */
+static void
+printstats(int dec, uint64_t ns)
+{
+	struct stats st;
+	struct metrics m;
+	uint64_t bytes;
+	uint64_t kdfns = 0;
+	double secs, iosecs;
+	int i;
+
+	stats_total(&st);
+	metrics_snapshot(&m);
+	bytes = dec ? m.bytes_decrypted : m.bytes_encrypted;
+	for (i = STATS_CALIBRATE; i <= STATS_FREE; i++)
+		kdfns += st.ns[i];
+
+	/* Throughput of the AES-CTR and HMAC pipeline, without the KDF. */
+	secs = ns / 1e9;
+	iosecs = (ns > kdfns) ? (ns - kdfns) / 1e9 : 0;
+
+	fprintf(stderr, "{\"mode\": \"%s\", \"bytes\": %llu, "
+	    "\"seconds\": %.6f, \"kdf_seconds\": %.6f, "
+	    "\"mb_per_sec\": %.2f, \"pipeline_mb_per_sec\": %.2f",
+	    dec ? "dec" : "enc", (unsigned long long)bytes,
+	    secs, kdfns / 1e9,
+	    secs > 0 ? bytes / secs / 1e6 : 0,
+	    iosecs > 0 ? bytes / iosecs / 1e6 : 0);
+	for (i = 0; i < STATS_NPHASES; i++)
+		fprintf(stderr, ", \"%s_seconds\": %.6f",
+		    stats_phase_name(i), st.ns[i] / 1e9);
+	fprintf(stderr, "}\n");
+}
+
+int
+main(int argc, char * argv[])
+{
+	FILE * infile = stdin;
+	FILE * outfile = stdout;
+	const char * outname = NULL;
+	const char * passfile = NULL;
+	char * passwd;
+	int dec = 0;
+	int logN = 0;
+	uint64_t N = 0;
+	uint32_t r = 8;
+	uint32_t p = 1;
+	int haverp = 0;
+	double maxtime = -1;
+	size_t maxmem = 0;
+	double maxmemfrac = -1;
+	size_t bufsize = 0;
+	size_t spoolmax = 16 * 1024 * 1024;
+	int havespool = 0;
+	int showstats = 0;
+	uint64_t t0;
+	int ch;
+	int rc;
+
+#ifdef NEED_WARN_PROGNAME
+	warn_progname = "scrypt";
+#endif
+
+	/* We should have "enc" or "dec" first. */
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "enc") == 0)
+		dec = 0;
+	else if (strcmp(argv[1], "dec") == 0)
+		dec = 1;
+	else
+		usage();
+	argc--;
+	argv++;
+
+	/* Parse the options. */
+	while ((ch = getopt_long(argc, argv, "N:r:p:t:m:M:T:b:k:S:",
+	    longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'N':
+			N = getnum(ch, optarg, UINT64_MAX);
+			break;
+		case 'r':
+			r = (uint32_t)getnum(ch, optarg, UINT32_MAX);
+			haverp = 1;
+			break;
+		case 'p':
+			p = (uint32_t)getnum(ch, optarg, UINT32_MAX);
+			haverp = 1;
+			break;
+		case 't':
+			maxtime = getfrac(ch, optarg);
+			break;
+		case 'm':
+			maxmem = (size_t)getnum(ch, optarg, SIZE_MAX);
+			break;
+		case 'M':
+			maxmemfrac = getfrac(ch, optarg);
+			break;
+		case 'T':
+			scryptdec_set_threads((int)getnum(ch, optarg, INT_MAX));
+			break;
+		case 'b':
+			bufsize = (size_t)getnum(ch, optarg,
+			    SCRYPTENC_BLOCKSIZE_MAX);
+			scryptenc_set_blocksize(bufsize);
+			break;
+		case 'k':
+			passfile = optarg;
+			break;
+		case 'S':
+			spoolmax = (size_t)getnum(ch, optarg, SIZE_MAX);
+			havespool = 1;
+			break;
+		case 's':
+			showstats = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 2)
+		usage();
+
+	/* N must be a power of 2, and r and p go with it. */
+	if (N != 0) {
+		if (dec || (N & (N - 1)) != 0 || N < 2 ||
+		    (uint64_t)(r) * (uint64_t)(p) >= (1 << 30) || r == 0 ||
+		    p == 0) {
+			warnx("-N, -r and -p must be a power of 2 above 1, "
+			    "and positive integers with r * p < 2^30, "
+			    "when encrypting");
+			exit(1);
+		}
+		while (((uint64_t)(1) << logN) < N)
+			logN++;
+	} else if (haverp) {
+		warnx("-r and -p need -N");
+		exit(1);
+	}
+	if (havespool && !dec) {
+		warnx("-S only applies when decrypting");
+		exit(1);
+	}
+
+	/* Default to the limits of the Python module. */
+	if (maxtime < 0)
+		maxtime = dec ? 300.0 : 5.0;
+	if (maxmemfrac < 0)
+		maxmemfrac = dec ? 0.5 : 0.125;
+
+	/* Open the input file; "-" or nothing means stdin. */
+	if ((argc > 0) && strcmp(argv[0], "-") != 0) {
+		if ((infile = fopen(argv[0], "rb")) == NULL) {
+			warn("Cannot open input file: %s", argv[0]);
+			exit(1);
+		}
+	}
+
+	/*
+	 * Get the passphrase, confirming it if we are encrypting from the
+	 * terminal, before the output file is truncated.
+	 */
+	if ((passwd = getpassphrase(passfile, !dec)) == NULL)
+		exit(1);
+
+	/* Open the output file; "-" or nothing means stdout. */
+	if ((argc > 1) && strcmp(argv[1], "-") != 0) {
+		outname = argv[1];
+		if ((outfile = fopen(outname, "wb")) == NULL) {
+			warn("Cannot open output file: %s", outname);
+			freepassphrase(passwd);
+			exit(1);
+		}
+	}
+	if (bufsize > 0) {
+		if (setvbuf(infile, NULL, _IOFBF, bufsize) ||
+		    setvbuf(outfile, NULL, _IOFBF, bufsize)) {
+			warnx("Cannot set buffer size to %zu", bufsize);
+			freepassphrase(passwd);
+			if (outname != NULL)
+				unlink(outname);
+			exit(1);
+		}
+	}
+
+	/*
+	 * Encrypt or decrypt.  Output we cannot remove if decryption fails,
+	 * such as a pipe, gets nothing until all of the input has been
+	 * authenticated: up to spoolmax bytes of plaintext wait in memory, and
+	 * the rest in a temporary file.  -S does the same for an output file.
+	 */
+	if (showstats)
+		stats_enable(1);
+	t0 = stats_now();
+	if (dec && (havespool || (outname == NULL)))
+		rc = scryptdec_file_spool(infile, outfile, (uint8_t *)passwd,
+		    strlen(passwd), maxmem, maxmemfrac, maxtime, spoolmax);
+	else if (dec)
+		rc = scryptdec_file(infile, outfile, (uint8_t *)passwd,
+		    strlen(passwd), maxmem, maxmemfrac, maxtime);
+	else if (logN != 0)
+		rc = scryptenc_file_params(infile, outfile, (uint8_t *)passwd,
+		    strlen(passwd), logN, r, p);
+	else
+		rc = scryptenc_file(infile, outfile, (uint8_t *)passwd,
+		    strlen(passwd), maxmem, maxmemfrac, maxtime);
+	if (rc == 0 && fflush(outfile) != 0)
+		rc = 12;
+	if (showstats)
+		printstats(dec, stats_now() - t0);
+
+	/* Zero and free the passphrase. */
+	freepassphrase(passwd);
+
+	/* Close any files we opened. */
+	if (infile != stdin)
+		fclose(infile);
+	if ((outfile != stdout) && (fclose(outfile) != 0) && (rc == 0))
+		rc = 12;
+
+	/* If we failed, print the right error message and exit. */
+	if (rc != 0) {
+		if ((rc == 12) || (rc == 13))
+			warn("%s", errstrs[rc]);
+		else
+			warnx("%s", errstrs[rc]);
+
+		/* Do not leave partial output behind. */
+		if (outname != NULL)
+			unlink(outname);
+		exit(1);
+	}
+
+	return (0);
+}
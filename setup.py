@@ -1,15 +1,29 @@
 #!/usr/bin/env python
-from distutils.core import setup, Extension
+from distutils.core import setup, Extension, Command
+from distutils.ccompiler import new_compiler
+from distutils.sysconfig import customize_compiler
 
+import glob
+import os
+import re
 import sys
 import platform
 
 includes = []
 library_dirs = []
 
+
+def have_header(name):
+    # look in the multiarch directories too, where Debian and Ubuntu keep
+    # the C library's own headers
+    dirs = ['/usr/include'] + glob.glob('/usr/include/*-linux-*')
+    return any(os.path.exists(os.path.join(d, name)) for d in dirs)
+
+
 if sys.platform.startswith('linux'):
     define_macros = [('HAVE_CLOCK_GETTIME', '1'),
                      ('HAVE_LIBRT', '1'),
+                     ('HAVE_POSIX_FALLOCATE', '1'),
                      ('HAVE_POSIX_MEMALIGN', '1'),
                      ('HAVE_STRUCT_SYSINFO', '1'),
                      ('HAVE_STRUCT_SYSINFO_MEM_UNIT', '1'),
@@ -18,6 +32,15 @@ if sys.platform.startswith('linux'):
                      ('HAVE_SYS_SYSINFO_H', '1'),
                      ('_FILE_OFFSET_BITS', '64')]
     libraries = ['crypto', 'rt']
+    # getrandom(2), if the C library declares it
+    if have_header('sys/random.h'):
+        define_macros.append(('HAVE_GETRANDOM', '1'))
+    # USDT probes, if the systemtap headers are installed
+    if have_header('sys/sdt.h'):
+        define_macros.append(('HAVE_SYS_SDT_H', '1'))
+    # io_uring, used through raw system calls when the kernel supports it
+    if have_header('linux/io_uring.h'):
+        define_macros.append(('HAVE_LINUX_IO_URING_H', '1'))
 elif sys.platform.startswith('win32'):
     define_macros = []
     library_dirs = ['c:\OpenSSL-Win32\lib\MinGW']
@@ -32,24 +55,172 @@ else:
     libraries = ['crypto']
 
 
+include_dirs = ['scrypt-1.1.6',
+                'scrypt-1.1.6/lib',
+                'scrypt-1.1.6/lib/scryptenc',
+                'scrypt-1.1.6/lib/crypto',
+                'scrypt-1.1.6/lib/util'] + includes
+define_macros = [('HAVE_CONFIG_H', None)] + define_macros
+
+
+# the C library, built both into the module and, by build_libscrypt, into
+# a shared library for use from other languages
+libscrypt_sources = ['scrypt-1.1.6/lib/crypto/crypto_aesctr.c',
+                     'scrypt-1.1.6/lib/crypto/crypto_scrypt-nosse.c',
+                     'scrypt-1.1.6/lib/crypto/sha256.c',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc.c',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_batch.c',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_cache.c',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_cpuperf.c',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_mcf.c',
+                     'scrypt-1.1.6/lib/util/entropy.c',
+                     'scrypt-1.1.6/lib/util/memlimit.c',
+                     'scrypt-1.1.6/lib/util/metrics.c',
+                     'scrypt-1.1.6/lib/util/stats.c',
+                     'scrypt-1.1.6/lib/util/warn.c']
+libscrypt_headers = ['scrypt-1.1.6/lib/libscrypt.h',
+                     'scrypt-1.1.6/lib/crypto/crypto_scrypt.h',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc.h',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_batch.h',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_cache.h',
+                     'scrypt-1.1.6/lib/scryptenc/scryptenc_mcf.h']
+libscrypt_version = '1.1.6'
+# declared by the headers for the library's own use, but not exported
+libscrypt_internal = ['scryptenc_cache_insert', 'scryptenc_cache_lookup']
+
+
+def libscrypt_exports():
+    """Return the names of the functions the headers declare, less the
+    internal ones; these are all libscrypt exports."""
+    names = set()
+    for header in libscrypt_headers:
+        with open(header) as f:
+            names.update(re.findall(r'^[a-z][\w ]*?[ *](\w+)\(', f.read(), re.M))
+    return sorted(names - set(libscrypt_internal))
+
 scrypt_module = Extension('scrypt',
-                          sources=['src/scrypt{0}.c'.format(platform.python_version_tuple()[0]),
-                                   'scrypt-1.1.6/lib/crypto/crypto_aesctr.c',
-                                   'scrypt-1.1.6/lib/crypto/crypto_scrypt-nosse.c',
-                                   'scrypt-1.1.6/lib/crypto/sha256.c',
-                                   'scrypt-1.1.6/lib/scryptenc/scryptenc.c',
-                                   'scrypt-1.1.6/lib/scryptenc/scryptenc_cpuperf.c',
-                                   'scrypt-1.1.6/lib/util/memlimit.c',
-                                   'scrypt-1.1.6/lib/util/warn.c'],
-                          include_dirs=['scrypt-1.1.6',
-                                        'scrypt-1.1.6/lib',
-                                        'scrypt-1.1.6/lib/scryptenc',
-                                        'scrypt-1.1.6/lib/crypto',
-                                        'scrypt-1.1.6/lib/util'] + includes,
-                          define_macros=[('HAVE_CONFIG_H', None)] + define_macros,
+                          sources=['src/scrypt{0}.c'.format(platform.python_version_tuple()[0])] + libscrypt_sources,
+                          include_dirs=include_dirs,
+                          define_macros=define_macros,
                           library_dirs=library_dirs,
                           libraries=libraries)
 
+
+class build_libscrypt(Command):
+    """Build the C library as build/lib/libscrypt.so, with its headers in
+    build/include."""
+
+    description = 'build the C library as a shared library'
+    user_options = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        objects = compiler.compile(libscrypt_sources,
+                                   output_dir='build/libscrypt',
+                                   include_dirs=include_dirs,
+                                   macros=define_macros,
+                                   extra_preargs=['-fPIC'])
+
+        # libscrypt.so.1.1.6, with the soname libscrypt.so.1, on ELF systems;
+        # only the functions in the headers are exported, so that the rest
+        # can change without breaking the ABI
+        name = compiler.library_filename('scrypt', lib_type='shared')
+        exports = libscrypt_exports()
+        extra = []
+        if sys.platform.startswith('linux'):
+            soname = name + '.' + libscrypt_version.split('.')[0]
+            mapfile = 'build/libscrypt/libscrypt.map'
+            with open(mapfile, 'w') as f:
+                f.write('LIBSCRYPT_1 {\n\tglobal:\n')
+                for export in exports:
+                    f.write('\t\t%s;\n' % export)
+                f.write('\tlocal:\n\t\t*;\n};\n')
+            extra = ['-Wl,-soname,' + soname, '-Wl,--version-script,' + mapfile]
+            links = [soname, name]
+            name += '.' + libscrypt_version
+        elif sys.platform.startswith('darwin'):
+            listfile = 'build/libscrypt/libscrypt.exp'
+            with open(listfile, 'w') as f:
+                for export in exports:
+                    f.write('_%s\n' % export)
+            extra = ['-Wl,-exported_symbols_list,' + listfile]
+            links = []
+        else:
+            links = []
+        compiler.link_shared_object(objects, name,
+                                    output_dir='build/lib',
+                                    libraries=libraries + ['pthread'],
+                                    library_dirs=library_dirs,
+                                    extra_postargs=extra)
+        for link in links:
+            path = os.path.join('build/lib', link)
+            if os.path.lexists(path):
+                os.remove(path)
+            os.symlink(name, path)
+
+        self.mkpath('build/include')
+        for header in libscrypt_headers:
+            self.copy_file(header, 'build/include')
+
+
+def build_executable(name, sources):
+    """Compile and link sources into build/name."""
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    objects = compiler.compile(sources,
+                               output_dir='build/temp.' + name,
+                               include_dirs=include_dirs,
+                               macros=define_macros)
+    compiler.link_executable(objects, name,
+                             output_dir='build',
+                             libraries=libraries + ['pthread'],
+                             library_dirs=library_dirs)
+
+
+class build_bench(Command):
+    """Build the C micro-benchmarks in bench/ as build/crypto-bench."""
+
+    description = 'build the C micro-benchmarks'
+    user_options = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        build_executable('crypto-bench',
+                         ['bench/crypto-bench.c',
+                          'scrypt-1.1.6/lib/crypto/crypto_aesctr.c',
+                          'scrypt-1.1.6/lib/crypto/sha256.c',
+                          'scrypt-1.1.6/lib/util/metrics.c',
+                          'scrypt-1.1.6/lib/util/stats.c'])
+
+
+class build_cli(Command):
+    """Build the scrypt command-line tool as build/scrypt."""
+
+    description = 'build the scrypt command-line tool'
+    user_options = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        build_executable('scrypt', ['scrypt-1.1.6/main.c'] + libscrypt_sources)
+
+
 setup(name='scrypt',
       version='1.1.6',
       description='Bindings for the scrypt key derivation function library',
@@ -57,6 +228,9 @@ setup(name='scrypt',
       author_email='mhallin@gmail.com',
       url='http://bitbucket.org/mhallin/py-scrypt',
       ext_modules=[scrypt_module],
+      cmdclass={'build_bench': build_bench,
+                'build_cli': build_cli,
+                'build_libscrypt': build_libscrypt},
       classifiers=['Development Status :: 4 - Beta',
                    'Programming Language :: Python :: 2',
                    'Programming Language :: Python :: 3',
@@ -25,8 +25,24 @@
  */
 
 #include <Python.h>
+#include <pythread.h>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "scryptenc/scryptenc.h"
+#include "scryptenc/scryptenc_batch.h"
+#include "scryptenc/scryptenc_cache.h"
+#include "scryptenc/scryptenc_mcf.h"
+#include "crypto/crypto_scrypt.h"
+#include "util/entropy.h"
+#include "util/metrics.h"
+#include "util/stats.h"
 
 static PyObject *ScryptError;
 
@@ -46,13 +62,136 @@ static const char *g_error_codes[] = {
     "error writing output file",
     "error reading input file"
 };
-static char *g_kwlist[] = {"input", "password", "maxtime", "maxmem", "maxmemfrac", NULL};
+
+// short labels for the error codes above, used by metrics()
+static const char *g_outcome_names[] = {
+    "success",
+    "memlimit",
+    "clock",
+    "kdf",
+    "salt",
+    "openssl",
+    "malloc",
+    "invalid",
+    "format",
+    "toomuchmem",
+    "toolong",
+    "password",
+    "write",
+    "read"
+};
+static char *g_kwlist[] = {"input", "password", "maxtime", "maxmem", "maxmemfrac", "maxN", "maxrp", "maxbytes", NULL};
+static char *g_enc_kwlist[] = {"input", "password", "maxtime", "maxmem", "maxmemfrac", "segmented", "N", "r", "p", NULL};
 static const size_t g_maxmem_default = 0;
 static const double g_maxmemfrac_default = 0.5;
 static const double g_maxmemfrac_default_enc = 0.125;
 static const double g_maxtime_default = 300.0;
 static const double g_maxtime_default_enc = 5.0;
 
+// return value << shift, stealing the reference to value
+static PyObject *shift_left(PyObject *value, int shift) {
+    PyObject *count, *result = NULL;
+
+    if ((count = PyLong_FromLong(shift)) != NULL) {
+        result = PyNumber_Lshift(value, count);
+        Py_DECREF(count);
+    }
+    Py_DECREF(value);
+    return result;
+}
+
+static int consttime_equal(const uint8_t *a, const uint8_t *b, size_t len) {
+    uint8_t diff = 0;
+    size_t i;
+
+    // accumulate differences so the running time does not depend on where
+    // the first mismatch is
+    for (i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static FILE *open_stream(PyObject *file, const char *mode) {
+    PyObject *result;
+    FILE *stream;
+    int fd;
+
+    // anything already buffered by a Python file object has to reach the
+    // descriptor before we start writing to it behind its back
+    if (PyObject_HasAttrString(file, "flush")) {
+        if ((result = PyObject_CallMethod(file, "flush", NULL)) == NULL) {
+            return NULL;
+        }
+        Py_DECREF(result);
+    }
+
+    if ((fd = PyObject_AsFileDescriptor(file)) == -1) {
+        return NULL;
+    }
+
+    // work on a duplicate so that closing our stream leaves the caller's
+    // descriptor open
+    if ((fd = dup(fd)) == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return NULL;
+    }
+    if ((stream = fdopen(fd, mode)) == NULL) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        close(fd);
+        return NULL;
+    }
+    return stream;
+}
+
+// the decryption ceilings, or NULL if none were given so that the
+// parameters are only checked against the memory and time limits
+static const struct scryptdec_ceilings *ceilings(const struct scryptdec_ceilings *ceil) {
+    if (ceil->maxN == 0 && ceil->maxrp == 0 && ceil->maxbytes == 0) {
+        return NULL;
+    }
+    return ceil;
+}
+
+// check explicit N, r and p, filling in the defaults for r and p and
+// setting *logN; if N is 0, leave *logN at 0 so that the parameters are
+// picked by measuring memory and CPU speed instead
+static int parse_params(uint64_t N, uint32_t *r, uint32_t *p, int *logN) {
+    *logN = 0;
+    if (N == 0) {
+        if (*r != 0 || *p != 0) {
+            PyErr_SetString(PyExc_ValueError, "r and p can only be given along with N");
+            return -1;
+        }
+        return 0;
+    }
+    if (*r == 0) {
+        *r = 8;
+    }
+    if (*p == 0) {
+        *p = 1;
+    }
+    if ((uint64_t) *r * *p >= (1 << 30) || N <= 1 || (N & (N-1)) != 0) {
+        PyErr_Format(ScryptError, "%s",
+            "encryption parameters are wrong (r*p should be < 2**30, and N should be a power of two > 1)");
+        return -1;
+    }
+    while (((uint64_t) 1 << *logN) < N) {
+        (*logN)++;
+    }
+    return 0;
+}
+
+// crypto_scrypt needs N a power of two > 1, and divides by r and p
+static int check_hash_params(uint64_t N, uint32_t r, uint32_t p) {
+    if (r == 0 || p == 0 || (uint64_t) r * p >= (1 << 30) || N <= 1 || (N & (N-1)) != 0) {
+        PyErr_Format(ScryptError, "%s",
+            "hash parameters are wrong (r and p should be > 0 with r*p < 2**30, and N should be a power of two > 1)");
+        return -1;
+    }
+    return 0;
+}
+
 static PyObject *scrypt_encrypt(PyObject *self, PyObject *args, PyObject *kwargs) {
     const char *input, *password;
     int inputlen, passwordlen;
@@ -60,29 +199,55 @@ static PyObject *scrypt_encrypt(PyObject *self, PyObject *args, PyObject *kwargs
     size_t maxmem = g_maxmem_default;
     double maxmemfrac = g_maxmemfrac_default_enc;
     double maxtime = g_maxtime_default_enc;
+    int segmented = 0;
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+    size_t outputlen;
     uint8_t *outbuf;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|dnd", g_kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|dndiKII", g_enc_kwlist,
                                      &input, &inputlen, &password, &passwordlen,
-                                     &maxtime, &maxmem, &maxmemfrac)) {
+                                     &maxtime, &maxmem, &maxmemfrac, &segmented, &N, &r, &p)) {
         return NULL;
     }
 
-    outbuf = PyMem_Malloc(inputlen+129);
+    // explicit parameters skip the memory and CPU speed measurements
+    if (parse_params(N, &r, &p, &logN) != 0) {
+        return NULL;
+    }
 
+    outputlen = segmented ? scryptenc_buf_seg_len(inputlen) : (size_t) inputlen+128;
+    outbuf = PyMem_Malloc(outputlen+1);
+
+    stats_begin();
     Py_BEGIN_ALLOW_THREADS;
-    errorcode = scryptenc_buf((uint8_t *) input, inputlen,
-                              outbuf,
-                              (uint8_t *) password, passwordlen,
-                              maxmem, maxmemfrac, maxtime);
+    if (logN != 0) {
+        errorcode = scryptenc_buf_params((uint8_t *) input, inputlen,
+                                         outbuf,
+                                         (uint8_t *) password, passwordlen,
+                                         logN, r, p, segmented);
+    } else if (segmented) {
+        errorcode = scryptenc_buf_seg((uint8_t *) input, inputlen,
+                                      outbuf,
+                                      (uint8_t *) password, passwordlen,
+                                      maxmem, maxmemfrac, maxtime);
+    } else {
+        errorcode = scryptenc_buf((uint8_t *) input, inputlen,
+                                  outbuf,
+                                  (uint8_t *) password, passwordlen,
+                                  maxmem, maxmemfrac, maxtime);
+    }
     Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_ENCRYPT, errorcode);
 
     PyObject *value = NULL;
     if (errorcode != 0) {
         PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
         PyErr_SetNone(ScryptError);
     } else {
-        value = Py_BuildValue("y#", outbuf, inputlen+128);
+        value = PyBytes_FromStringAndSize((const char *) outbuf, outputlen);
     }
     PyMem_Free(outbuf);
 
@@ -97,22 +262,26 @@ static PyObject *scrypt_decrypt(PyObject *self, PyObject *args, PyObject *kwargs
     size_t maxmem = g_maxmem_default;
     double maxmemfrac = g_maxmemfrac_default;
     double maxtime = g_maxtime_default;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
     uint8_t *outbuf;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|dnd", g_kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|dndKKK", g_kwlist,
                                      &input, &inputlen, &password, &passwordlen,
-                                     &maxtime, &maxmem, &maxmemfrac)) {
+                                     &maxtime, &maxmem, &maxmemfrac,
+                                     &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
         return NULL;
     }
 
     outbuf = PyMem_Malloc(inputlen);
 
+    stats_begin();
     Py_BEGIN_ALLOW_THREADS;
-    errorcode = scryptdec_buf((const uint8_t *) input, inputlen,
-                              outbuf, &outputlen,
-                              (const uint8_t *) password, passwordlen,
-                              maxmem, maxmemfrac, maxtime);
+    errorcode = scryptdec_buf_ceil((const uint8_t *) input, inputlen,
+                                   outbuf, &outputlen,
+                                   (const uint8_t *) password, passwordlen,
+                                   maxmem, maxmemfrac, maxtime, ceilings(&ceil));
     Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_DECRYPT, errorcode);
 
     PyObject *value = NULL;
     if (errorcode != 0) {
@@ -123,85 +292,1579 @@ static PyObject *scrypt_decrypt(PyObject *self, PyObject *args, PyObject *kwargs
     PyMem_Free(outbuf);
     return value;
 }
+
+static PyObject *scrypt_decrypt_range(PyObject *self, PyObject *args, PyObject *kwargs) {
+    const char *input, *password;
+    int inputlen, passwordlen;
+    unsigned long long offset;
+    Py_ssize_t length;
+    size_t outputlen;
+    int errorcode;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = g_maxmemfrac_default;
+    double maxtime = g_maxtime_default;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+    uint8_t *outbuf;
+
+    static char *g8_kwlist[] = {"input", "password", "offset", "length", "maxtime", "maxmem", "maxmemfrac", "maxN", "maxrp", "maxbytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#Kn|dndKKK", g8_kwlist,
+                                     &input, &inputlen, &password, &passwordlen,
+                                     &offset, &length,
+                                     &maxtime, &maxmem, &maxmemfrac,
+                                     &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return NULL;
+    }
+
+    if (length < 0) {
+        PyErr_SetString(PyExc_ValueError, "length must not be negative");
+        return NULL;
+    }
+
+    // the range never holds more than the input does
+    if (length > inputlen) {
+        length = inputlen;
+    }
+    if ((outbuf = PyMem_Malloc(length+1)) == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    errorcode = scryptdec_buf_range_ceil((const uint8_t *) input, inputlen,
+                                         offset, length, outbuf, &outputlen,
+                                         (const uint8_t *) password, passwordlen,
+                                         maxmem, maxmemfrac, maxtime, ceilings(&ceil));
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_DECRYPT_RANGE, errorcode);
+
+    PyObject *value = NULL;
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+    } else {
+        value = PyBytes_FromStringAndSize((const char *) outbuf, outputlen);
+    }
+    PyMem_Free(outbuf);
+    return value;
+}
+
+static PyObject *scrypt_decrypt_stream_range(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *infile;
+    const char *password;
+    int passwordlen;
+    unsigned long long offset;
+    Py_ssize_t length;
+    size_t outputlen;
+    int errorcode;
+    int fd;
+    struct stat sb;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = g_maxmemfrac_default;
+    double maxtime = g_maxtime_default;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+    uint8_t *outbuf;
+
+    static char *g11_kwlist[] = {"infile", "password", "offset", "length", "maxtime", "maxmem", "maxmemfrac", "maxN", "maxrp", "maxbytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os#Kn|dndKKK", g11_kwlist,
+                                     &infile, &password, &passwordlen,
+                                     &offset, &length,
+                                     &maxtime, &maxmem, &maxmemfrac,
+                                     &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return NULL;
+    }
+
+    if (length < 0) {
+        PyErr_SetString(PyExc_ValueError, "length must not be negative");
+        return NULL;
+    }
+    if ((fd = PyObject_AsFileDescriptor(infile)) == -1) {
+        return NULL;
+    }
+
+    // the range never holds more than the file does
+    if (fstat(fd, &sb) != 0) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    if ((unsigned long long) length > (unsigned long long) sb.st_size) {
+        length = (Py_ssize_t) sb.st_size;
+    }
+    if ((outbuf = PyMem_Malloc(length+1)) == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    errorcode = scryptdec_fd_range_ceil(fd, offset, length, outbuf, &outputlen,
+                                        (const uint8_t *) password, passwordlen,
+                                        maxmem, maxmemfrac, maxtime, ceilings(&ceil));
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_DECRYPT_RANGE, errorcode);
+
+    PyObject *value = NULL;
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+    } else {
+        value = PyBytes_FromStringAndSize((const char *) outbuf, outputlen);
+    }
+    memset(outbuf, 0, length);
+    PyMem_Free(outbuf);
+    return value;
+}
+
+static PyObject *scrypt_inspect(PyObject *self, PyObject *args, PyObject *kwargs) {
+    const char *input;
+    int inputlen;
+    int errorcode;
+    int logN;
+    uint32_t r, p;
+    uint8_t salt[32];
+    PyObject *mem, *ops;
+
+    static char *g10_kwlist[] = {"input", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#", g10_kwlist,
+                                     &input, &inputlen)) {
+        return NULL;
+    }
+
+    errorcode = scryptenc_inspect((const uint8_t *) input, inputlen,
+                                  &logN, &r, &p, salt);
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+
+    // 128 * r * N bytes and 4 * N * r * p salsa20/8 cores; N can be up to
+    // 2^63, so leave the shifting to Python
+    mem = PyLong_FromUnsignedLongLong(128 * (unsigned long long) r);
+    ops = PyLong_FromUnsignedLongLong(4 * (unsigned long long) r * p);
+    if (mem == NULL || ops == NULL) {
+        Py_XDECREF(mem);
+        Py_XDECREF(ops);
+        return NULL;
+    }
+    return Py_BuildValue("(iIIy#NN)", logN, r, p, salt, 32,
+                         shift_left(mem, logN), shift_left(ops, logN));
+}
+
+static char *g_enc_stream_kwlist[] = {"infile", "outfile", "password", "maxtime", "maxmem", "maxmemfrac", "N", "r", "p", NULL};
+static char *g_dec_stream_kwlist[] = {"infile", "outfile", "password", "maxtime", "maxmem", "maxmemfrac", "spool", "maxN", "maxrp", "maxbytes", NULL};
+
+static PyObject *scrypt_stream(PyObject *args, PyObject *kwargs, int encrypt) {
+    PyObject *infile, *outfile;
+    const char *password;
+    int passwordlen;
+    int errorcode;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = encrypt ? g_maxmemfrac_default_enc : g_maxmemfrac_default;
+    double maxtime = encrypt ? g_maxtime_default_enc : g_maxtime_default;
+    Py_ssize_t spool = -1;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+    FILE *instream, *outstream;
+
+    if (encrypt) {
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOs#|dndKII", g_enc_stream_kwlist,
+                                         &infile, &outfile, &password, &passwordlen,
+                                         &maxtime, &maxmem, &maxmemfrac, &N, &r, &p)) {
+            return NULL;
+        }
+        if (parse_params(N, &r, &p, &logN) != 0) {
+            return NULL;
+        }
+    } else if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOs#|dndnKKK", g_dec_stream_kwlist,
+                                            &infile, &outfile, &password, &passwordlen,
+                                            &maxtime, &maxmem, &maxmemfrac, &spool,
+                                            &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return NULL;
+    }
+
+    if ((instream = open_stream(infile, "rb")) == NULL) {
+        return NULL;
+    }
+    if ((outstream = open_stream(outfile, "wb")) == NULL) {
+        fclose(instream);
+        return NULL;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    if (encrypt && logN != 0) {
+        errorcode = scryptenc_file_params(instream, outstream,
+                                          (const uint8_t *) password, passwordlen,
+                                          logN, r, p);
+    } else if (encrypt) {
+        errorcode = scryptenc_file(instream, outstream,
+                                   (const uint8_t *) password, passwordlen,
+                                   maxmem, maxmemfrac, maxtime);
+    } else if (spool >= 0) {
+        errorcode = scryptdec_file_spool_ceil(instream, outstream,
+                                              (const uint8_t *) password, passwordlen,
+                                              maxmem, maxmemfrac, maxtime, (size_t) spool,
+                                              ceilings(&ceil));
+    } else {
+        errorcode = scryptdec_file_ceil(instream, outstream,
+                                        (const uint8_t *) password, passwordlen,
+                                        maxmem, maxmemfrac, maxtime, ceilings(&ceil));
+    }
+    if (fclose(outstream) != 0 && errorcode == 0) {
+        errorcode = 12;
+    }
+    fclose(instream);
+    Py_END_ALLOW_THREADS;
+    metrics_call(encrypt ? METRICS_ENCRYPT_STREAM : METRICS_DECRYPT_STREAM, errorcode);
+
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_encrypt_stream(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return scrypt_stream(args, kwargs, 1);
+}
+
+static PyObject *scrypt_decrypt_stream(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return scrypt_stream(args, kwargs, 0);
+}
+
+static char *g_path_kwlist[] = {"path_in", "path_out", "password", "maxtime", "maxmem", "maxmemfrac", "maxN", "maxrp", "maxbytes", NULL};
+static char *g_enc_path_kwlist[] = {"path_in", "path_out", "password", "maxtime", "maxmem", "maxmemfrac", "N", "r", "p", NULL};
+
+static PyObject *scrypt_path(PyObject *args, PyObject *kwargs, int encrypt) {
+    const char *path_in, *path_out;
+    const char *password;
+    int passwordlen;
+    int errorcode;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = encrypt ? g_maxmemfrac_default_enc : g_maxmemfrac_default;
+    double maxtime = encrypt ? g_maxtime_default_enc : g_maxtime_default;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+
+    if (encrypt) {
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sss#|dndKII", g_enc_path_kwlist,
+                                         &path_in, &path_out, &password, &passwordlen,
+                                         &maxtime, &maxmem, &maxmemfrac, &N, &r, &p)) {
+            return NULL;
+        }
+        if (parse_params(N, &r, &p, &logN) != 0) {
+            return NULL;
+        }
+    } else if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sss#|dndKKK", g_path_kwlist,
+                                            &path_in, &path_out, &password, &passwordlen,
+                                            &maxtime, &maxmem, &maxmemfrac,
+                                            &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return NULL;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    if (encrypt && logN != 0) {
+        errorcode = scryptenc_path_params(path_in, path_out,
+                                          (const uint8_t *) password, passwordlen,
+                                          logN, r, p);
+    } else if (encrypt) {
+        errorcode = scryptenc_path(path_in, path_out,
+                                   (const uint8_t *) password, passwordlen,
+                                   maxmem, maxmemfrac, maxtime);
+    } else {
+        errorcode = scryptdec_path_ceil(path_in, path_out,
+                                        (const uint8_t *) password, passwordlen,
+                                        maxmem, maxmemfrac, maxtime, ceilings(&ceil));
+    }
+    Py_END_ALLOW_THREADS;
+    metrics_call(encrypt ? METRICS_ENCRYPT_FILE : METRICS_DECRYPT_FILE, errorcode);
+
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_encrypt_file(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return scrypt_path(args, kwargs, 1);
+}
+
+static PyObject *scrypt_decrypt_file(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return scrypt_path(args, kwargs, 0);
+}
+
+static char *g_files_kwlist[] = {"paths", "password", "maxtime", "maxmem", "maxmemfrac", "threads", "N", "r", "p", NULL};
+
+static PyObject *scrypt_encrypt_files(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *paths, *seq, *pairs = NULL, *item;
+    PyObject *result = NULL;
+    const char *password;
+    int passwordlen;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = g_maxmemfrac_default_enc;
+    double maxtime = g_maxtime_default_enc;
+    int nthreads = 0;
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+    const char **inpaths = NULL, **outpaths = NULL;
+    int *rcs = NULL;
+    Py_ssize_t n, i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os#|dndiKII", g_files_kwlist,
+                                     &paths, &password, &passwordlen,
+                                     &maxtime, &maxmem, &maxmemfrac, &nthreads,
+                                     &N, &r, &p)) {
+        return NULL;
+    }
+    if (parse_params(N, &r, &p, &logN) != 0) {
+        return NULL;
+    }
+
+    if (nthreads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+        return NULL;
+    }
+
+    // copy the sequence and each pair into tuples, which hold the strings
+    // we point into and which no other thread can change while the GIL is
+    // released
+    if ((seq = PySequence_Tuple(paths)) == NULL) {
+        return NULL;
+    }
+    n = PyTuple_GET_SIZE(seq);
+    if ((pairs = PyTuple_New(n)) == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    inpaths = PyMem_Malloc((n + 1) * sizeof(const char *));
+    outpaths = PyMem_Malloc((n + 1) * sizeof(const char *));
+    rcs = PyMem_Malloc((n + 1) * sizeof(int));
+    if (inpaths == NULL || outpaths == NULL || rcs == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+    for (i = 0; i < n; i++) {
+        if ((item = PySequence_Tuple(PyTuple_GET_ITEM(seq, i))) == NULL) {
+            goto done;
+        }
+        PyTuple_SET_ITEM(pairs, i, item);
+        if (!PyArg_ParseTuple(item, "ss", &inpaths[i], &outpaths[i])) {
+            goto done;
+        }
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    if (logN != 0) {
+        scryptenc_file_batch_params(inpaths, outpaths, n,
+                                    (const uint8_t *) password, passwordlen,
+                                    logN, r, p, nthreads, rcs);
+    } else {
+        scryptenc_file_batch(inpaths, outpaths, n,
+                             (const uint8_t *) password, passwordlen,
+                             maxmem, maxmemfrac, maxtime, nthreads, rcs);
+    }
+    Py_END_ALLOW_THREADS;
+
+    // one entry per file: None, or the error it failed with
+    if ((result = PyList_New(n)) == NULL) {
+        goto done;
+    }
+    for (i = 0; i < n; i++) {
+        metrics_call(METRICS_ENCRYPT_FILES, rcs[i]);
+        if (rcs[i] == 0) {
+            Py_INCREF(Py_None);
+            item = Py_None;
+        } else if ((item = PyObject_CallFunction(ScryptError, "s", g_error_codes[rcs[i]])) == NULL) {
+            Py_CLEAR(result);
+            goto done;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+
+done:
+    PyMem_Free(inpaths);
+    PyMem_Free(outpaths);
+    PyMem_Free(rcs);
+    Py_DECREF(pairs);
+    Py_DECREF(seq);
+    return result;
+}
+
 static PyObject *scrypt_hash(PyObject *self, PyObject *args, PyObject* kwargs) {
     const char *password,   *salt;
     int      passwordlen, saltlen;
-    int paramerror, hasherror;
+    int hasherror;
     uint64_t N = 1 << 14;
     uint32_t r = 8;
     uint32_t p = 1;
     uint8_t *outbuf;
     size_t   outbuflen;
+    Py_ssize_t buflen = 64;
 
-    static char *g2_kwlist[] = {"password", "salt", "N", "r", "p", NULL};
+    static char *g2_kwlist[] = {"password", "salt", "N", "r", "p", "buflen", NULL};
 
-    // note, this assumes uint32_t is unsigned long (k)
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|Kkk", g2_kwlist,
+    // note, this assumes uint32_t is unsigned int (I)
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|KIIn", g2_kwlist,
                                      &password, &passwordlen, &salt, &saltlen,
-                                     &N, &r, &p)) {
+                                     &N, &r, &p, &buflen)) {
         return NULL;
     }
 
     // note, output buffer must be less than (2^32-1) * 32
-    outbuf = PyMem_Malloc(64);
-    outbuflen = 64;
+    if (buflen < 1 || (uint64_t) buflen > (((uint64_t) 1 << 32) - 1) * 32) {
+        PyErr_Format(ScryptError, "%s", "buflen should be > 0 and <= (2**32-1) * 32");
+        return NULL;
+    }
+    if (check_hash_params(N, r, p) != 0) {
+        metrics_call(METRICS_HASH, 7);
+        return NULL;
+    }
+
+    outbuflen = buflen;
+    outbuf = PyMem_Malloc(outbuflen);
+    if (outbuf == NULL) {
+        return PyErr_NoMemory();
+    }
 
+    stats_begin();
     Py_BEGIN_ALLOW_THREADS;
 
-    if ( r * p >= (1 << 30) || N <= 1 || (N & (N-1)) != 0) {
-        paramerror = -1;
-    } else {
-        paramerror = 0;
-        hasherror = crypto_scrypt(password, passwordlen,
-                                  salt,     saltlen,
-                                  N, r, p,
-                                  outbuf, outbuflen);
-    }
+    hasherror = crypto_scrypt((const uint8_t *) password, passwordlen,
+                              (const uint8_t *) salt,     saltlen,
+                              N, r, p,
+                              outbuf, outbuflen);
 
     Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_HASH, hasherror != 0 ? 3 : 0);
 
     PyObject *value = NULL;
-    if (paramerror != 0) {
-        PyErr_Format(ScryptError, "%s",
-            "hash parameters are wrong (r*p should be < 2**30, and N should be a power of two > 1)");
+    if (hasherror != 0) {
+        PyErr_Format(ScryptError, "%s", "could not compute hash");
     } else {
-        if (hasherror != 0) {
-            PyErr_Format(ScryptError, "%s", "could not compute hash");
-        } else {
-            value = Py_BuildValue("y#", outbuf, outbuflen);
-        }
+        value = PyBytes_FromStringAndSize((const char *) outbuf, outbuflen);
     }
     PyMem_Free(outbuf);
     return value;
 }
 
-static PyMethodDef ScryptMethods[] = {
-    { "encrypt", (PyCFunction) scrypt_encrypt, METH_VARARGS | METH_KEYWORDS,
-      "encrypt(input, password, maxtime=5.0, maxmem=0, maxmemfrac=0.125): str; encrypt a string" },
-    { "decrypt", (PyCFunction) scrypt_decrypt, METH_VARARGS | METH_KEYWORDS,
-      "decrypt(input, password, maxtime=300.0, maxmem=0, maxmemfrac=0.5): str; decrypt a string" },
-    { "hash", (PyCFunction) scrypt_hash, METH_VARARGS | METH_KEYWORDS,
-      "hash(password, salt, N=2**14, r=8, p=1): str; compute a 64-byte scrypt hash" },
-    { NULL, NULL, 0, NULL }
-};
+static PyObject *scrypt_verify(PyObject *self, PyObject *args, PyObject* kwargs) {
+    const char *password,   *salt,   *expected;
+    int      passwordlen, saltlen, expectedlen;
+    int hasherror, match = 0;
+    uint64_t N = 1 << 14;
+    uint32_t r = 8;
+    uint32_t p = 1;
+    uint8_t *outbuf;
 
-static struct PyModuleDef scryptmodule = {
-    PyModuleDef_HEAD_INIT,
-    "scrypt",
-    NULL,
-    -1,
-    ScryptMethods
-};
+    static char *g3_kwlist[] = {"password", "salt", "expected", "N", "r", "p", NULL};
 
-PyMODINIT_FUNC PyInit_scrypt(void) {
-    PyObject *m = PyModule_Create(&scryptmodule);
+    // note, this assumes uint32_t is unsigned int (I)
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#s#|KII", g3_kwlist,
+                                     &password, &passwordlen, &salt, &saltlen,
+                                     &expected, &expectedlen,
+                                     &N, &r, &p)) {
+        return NULL;
+    }
 
-    if (m == NULL) {
+    if (expectedlen < 1) {
+        PyErr_Format(ScryptError, "%s", "expected hash must not be empty");
+        return NULL;
+    }
+    if (check_hash_params(N, r, p) != 0) {
+        metrics_call(METRICS_VERIFY, 7);
         return NULL;
     }
 
-    ScryptError = PyErr_NewException("scrypt.error", NULL, NULL);
-    Py_INCREF(ScryptError);
+    // only derive as many bytes as we are going to compare against
+    outbuf = PyMem_Malloc(expectedlen);
+    if (outbuf == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+
+    hasherror = crypto_scrypt((const uint8_t *) password, passwordlen,
+                              (const uint8_t *) salt,     saltlen,
+                              N, r, p,
+                              outbuf, expectedlen);
+    if (hasherror == 0) {
+        match = consttime_equal(outbuf, (const uint8_t *) expected, expectedlen);
+    }
+    memset(outbuf, 0, expectedlen);
+
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_VERIFY, hasherror != 0 ? 3 : (match ? 0 : 11));
+
+    PyMem_Free(outbuf);
+
+    if (hasherror != 0) {
+        PyErr_Format(ScryptError, "%s", "could not compute hash");
+        return NULL;
+    }
+    return PyBool_FromLong(match);
+}
+
+static PyObject *scrypt_random_salt(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Py_ssize_t n = 32;
+    PyObject *value;
+
+    static char *g7_kwlist[] = {"n", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", g7_kwlist, &n)) {
+        return NULL;
+    }
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "n must not be negative");
+        return NULL;
+    }
+
+    if ((value = PyBytes_FromStringAndSize(NULL, n)) == NULL) {
+        return NULL;
+    }
+    if (entropy_read((uint8_t *) PyBytes_AS_STRING(value), n)) {
+        Py_DECREF(value);
+        PyErr_Format(ScryptError, "%s", g_error_codes[4]);
+        return NULL;
+    }
+    return value;
+}
+
+static PyObject *scrypt_set_salt_pool(PyObject *self, PyObject *args) {
+    PyObject *enable;
+
+    if (!PyArg_ParseTuple(args, "O", &enable)) {
+        return NULL;
+    }
+
+    entropy_pool_enable(PyObject_IsTrue(enable) == 1);
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_set_threads(PyObject *self, PyObject *args) {
+    int nthreads;
+
+    if (!PyArg_ParseTuple(args, "i", &nthreads)) {
+        return NULL;
+    }
+
+    if (nthreads < 0) {
+        PyErr_SetString(PyExc_ValueError, "nthreads must not be negative");
+        return NULL;
+    }
+
+    scryptdec_set_threads(nthreads);
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_set_blocksize(PyObject *self, PyObject *args) {
+    Py_ssize_t blocksize;
+
+    if (!PyArg_ParseTuple(args, "n", &blocksize)) {
+        return NULL;
+    }
+
+    if (blocksize < 0) {
+        PyErr_SetString(PyExc_ValueError, "blocksize must not be negative");
+        return NULL;
+    }
+
+    if (scryptenc_set_blocksize((size_t)blocksize) != 0) {
+        PyErr_Format(PyExc_ValueError, "blocksize must be at most %d", SCRYPTENC_BLOCKSIZE_MAX);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_set_key_cache(PyObject *self, PyObject *args, PyObject *kwargs) {
+    Py_ssize_t maxentries;
+    double ttl = 0.0;
+
+    static char *g9_kwlist[] = {"maxentries", "ttl", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|d", g9_kwlist,
+                                     &maxentries, &ttl)) {
+        return NULL;
+    }
+
+    if (maxentries < 0 || ttl < 0) {
+        PyErr_SetString(PyExc_ValueError, "maxentries and ttl must not be negative");
+        return NULL;
+    }
+
+    if (scryptenc_cache_enable(maxentries, ttl)) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_clear_key_cache(PyObject *self) {
+    scryptenc_cache_clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject *stats_to_dict(const struct stats *st) {
+    PyObject *dict;
+    PyObject *phase;
+    int i;
+
+    if ((dict = Py_BuildValue("{s:K,s:K}",
+                              "minflt", (unsigned PY_LONG_LONG) st->minflt,
+                              "majflt", (unsigned PY_LONG_LONG) st->majflt)) == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < STATS_NPHASES; i++) {
+        phase = Py_BuildValue("{s:K,s:K,s:K}",
+                              "ns", (unsigned PY_LONG_LONG) st->ns[i],
+                              "bytes", (unsigned PY_LONG_LONG) st->bytes[i],
+                              "calls", (unsigned PY_LONG_LONG) st->calls[i]);
+        if (phase == NULL || PyDict_SetItemString(dict, stats_phase_name(i), phase) != 0) {
+            Py_XDECREF(phase);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(phase);
+    }
+    return dict;
+}
+
+static PyObject *scrypt_enable_stats(PyObject *self, PyObject *args) {
+    PyObject *enable;
+
+    if (!PyArg_ParseTuple(args, "O", &enable)) {
+        return NULL;
+    }
+
+    stats_enable(PyObject_IsTrue(enable) == 1);
+    Py_RETURN_NONE;
+}
+
+static PyObject *scrypt_last_stats(PyObject *self) {
+    struct stats st;
+
+    stats_last(&st);
+    return stats_to_dict(&st);
+}
+
+static PyObject *scrypt_stats(PyObject *self) {
+    struct stats st;
+
+    stats_total(&st);
+    return stats_to_dict(&st);
+}
+
+static PyObject *scrypt_reset_stats(PyObject *self) {
+    stats_reset();
+    Py_RETURN_NONE;
+}
+
+static PyObject *kdf_to_dict(const struct metrics_kdf *k) {
+    PyObject *buckets;
+    PyObject *bucket;
+    PyObject *dict;
+    uint64_t cumulative = 0;
+    uint64_t ms;
+    int i;
+
+    if ((buckets = PyList_New(METRICS_NBUCKETS)) == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < METRICS_NBUCKETS; i++) {
+        cumulative += k->buckets[i];
+        ms = metrics_bucket_ms(i);
+        bucket = Py_BuildValue("(dK)", ms != 0 ? ms / 1000.0 : Py_HUGE_VAL,
+                               (unsigned PY_LONG_LONG) cumulative);
+        if (bucket == NULL) {
+            Py_DECREF(buckets);
+            return NULL;
+        }
+        PyList_SET_ITEM(buckets, i, bucket);
+    }
+
+    if (k->logN < 0) {
+        dict = Py_BuildValue("{s:O,s:O,s:O,s:K,s:d,s:N}",
+                             "N", Py_None, "r", Py_None, "p", Py_None,
+                             "count", (unsigned PY_LONG_LONG) k->count,
+                             "sum", k->sum_ns / 1e9,
+                             "buckets", buckets);
+    } else {
+        dict = Py_BuildValue("{s:K,s:I,s:I,s:K,s:d,s:N}",
+                             "N", (unsigned PY_LONG_LONG) 1 << k->logN,
+                             "r", (unsigned int) k->r, "p", (unsigned int) k->p,
+                             "count", (unsigned PY_LONG_LONG) k->count,
+                             "sum", k->sum_ns / 1e9,
+                             "buckets", buckets);
+    }
+    return dict;
+}
+
+static PyObject *scrypt_metrics(PyObject *self) {
+    struct metrics *m;
+    PyObject *dict = NULL;
+    PyObject *calls = NULL;
+    PyObject *outcomes;
+    PyObject *kdf = NULL;
+    PyObject *item;
+    int api, outcome;
+    size_t i;
+
+    // too large for the stack of some threads
+    if ((m = PyMem_Malloc(sizeof(struct metrics))) == NULL) {
+        return PyErr_NoMemory();
+    }
+    metrics_snapshot(m);
+
+    if ((calls = PyDict_New()) == NULL) {
+        goto err;
+    }
+    for (api = 0; api < METRICS_NAPIS; api++) {
+        outcomes = NULL;
+        for (outcome = 0; outcome < METRICS_NOUTCOMES; outcome++) {
+            if (m->calls[api][outcome] == 0) {
+                continue;
+            }
+            if (outcomes == NULL) {
+                if ((outcomes = PyDict_New()) == NULL ||
+                    PyDict_SetItemString(calls, metrics_api_name(api), outcomes) != 0) {
+                    Py_XDECREF(outcomes);
+                    goto err;
+                }
+                Py_DECREF(outcomes);
+            }
+            item = PyLong_FromUnsignedLongLong(m->calls[api][outcome]);
+            if (item == NULL ||
+                PyDict_SetItemString(outcomes, g_outcome_names[outcome], item) != 0) {
+                Py_XDECREF(item);
+                goto err;
+            }
+            Py_DECREF(item);
+        }
+    }
+
+    if ((kdf = PyList_New(m->nkdf)) == NULL) {
+        goto err;
+    }
+    for (i = 0; i < m->nkdf; i++) {
+        if ((item = kdf_to_dict(&m->kdf[i])) == NULL) {
+            goto err;
+        }
+        PyList_SET_ITEM(kdf, i, item);
+    }
+
+    dict = Py_BuildValue("{s:O,s:O,s:K,s:K,s:K,s:K}",
+                         "calls", calls,
+                         "kdf_seconds", kdf,
+                         "bytes_encrypted", (unsigned PY_LONG_LONG) m->bytes_encrypted,
+                         "bytes_decrypted", (unsigned PY_LONG_LONG) m->bytes_decrypted,
+                         "v_memory_bytes", (unsigned PY_LONG_LONG) m->vmem,
+                         "calibrations", (unsigned PY_LONG_LONG) m->calibrations);
+
+err:
+    Py_XDECREF(calls);
+    Py_XDECREF(kdf);
+    PyMem_Free(m);
+    return dict;
+}
+
+static PyObject *scrypt_mcf_hash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    const char *password;
+    int passwordlen;
+    int errorcode;
+    uint64_t N = 1 << 14;
+    uint32_t r = 8;
+    uint32_t p = 1;
+    int logN;
+    char mcf[SCRYPTENC_MCF_MAXLEN];
+
+    static char *g4_kwlist[] = {"password", "N", "r", "p", NULL};
+
+    // note, this assumes uint32_t is unsigned int (I)
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|KII", g4_kwlist,
+                                     &password, &passwordlen,
+                                     &N, &r, &p)) {
+        return NULL;
+    }
+
+    if (check_hash_params(N, r, p) != 0) {
+        metrics_call(METRICS_MCF_HASH, 7);
+        return NULL;
+    }
+    logN = 0;
+    while (((uint64_t) 1 << logN) < N) {
+        logN++;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    errorcode = scryptenc_mcf_hash((const uint8_t *) password, passwordlen,
+                                   logN, r, p, mcf);
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_MCF_HASH, errorcode);
+
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    return PyUnicode_FromString(mcf);
+}
+
+static PyObject *scrypt_mcf_verify(PyObject *self, PyObject *args, PyObject *kwargs) {
+    const char *password, *mcf;
+    int passwordlen;
+    int errorcode;
+
+    static char *g5_kwlist[] = {"password", "mcf", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s", g5_kwlist,
+                                     &password, &passwordlen, &mcf)) {
+        return NULL;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    errorcode = scryptenc_mcf_verify((const uint8_t *) password, passwordlen, mcf);
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_MCF_VERIFY, errorcode);
+
+    if (errorcode == 11) {
+        Py_RETURN_FALSE;
+    } else if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+static PyObject *scrypt_needs_rehash(PyObject *self, PyObject *args, PyObject *kwargs) {
+    const char *mcf;
+    int errorcode;
+    uint64_t N = 1 << 14;
+    uint32_t r = 8;
+    uint32_t p = 1;
+    int mcf_logN;
+    uint32_t mcf_r, mcf_p;
+
+    static char *g6_kwlist[] = {"mcf", "N", "r", "p", NULL};
+
+    // note, this assumes uint32_t is unsigned int (I)
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|KII", g6_kwlist,
+                                     &mcf, &N, &r, &p)) {
+        return NULL;
+    }
+
+    errorcode = scryptenc_mcf_params(mcf, &mcf_logN, &mcf_r, &mcf_p);
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+
+    return PyBool_FromLong(((uint64_t) 1 << mcf_logN) != N || mcf_r != r || mcf_p != p);
+}
+
+// chunks at least this large are processed with the GIL released
+#define STREAM_GIL_MINSIZE 2048
+
+typedef struct {
+    PyObject_HEAD
+    struct scryptenc_stream *stream;
+    PyThread_type_lock lock;
+    int decrypt;
+    int finished;
+    // encryptor: the header, until it has been returned; decryptor: the
+    // header until it is complete, and after that the last 32 bytes seen
+    uint8_t buf[96];
+    size_t buflen;
+    // decryptor: the password and limits, until the header has arrived
+    uint8_t *password;
+    size_t passwordlen;
+    size_t maxmem;
+    double maxmemfrac;
+    double maxtime;
+    struct scryptdec_ceilings ceil;
+} ScryptStreamObject;
+
+// serialize access to a stream whose methods may release the GIL
+#define ENTER_STREAM(obj) \
+    if (!PyThread_acquire_lock((obj)->lock, 0)) { \
+        Py_BEGIN_ALLOW_THREADS \
+        PyThread_acquire_lock((obj)->lock, 1); \
+        Py_END_ALLOW_THREADS \
+    }
+#define LEAVE_STREAM(obj) PyThread_release_lock((obj)->lock)
+
+static void stream_forget_password(ScryptStreamObject *self) {
+    if (self->password != NULL) {
+        memset(self->password, 0, self->passwordlen);
+        PyMem_Free(self->password);
+        self->password = NULL;
+    }
+}
+
+static void stream_dealloc(ScryptStreamObject *self) {
+    scryptenc_stream_free(self->stream);
+    stream_forget_password(self);
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
+    }
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int encryptor_init(ScryptStreamObject *self, PyObject *args, PyObject *kwargs) {
+    const char *password;
+    int passwordlen;
+    int errorcode;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = g_maxmemfrac_default_enc;
+    double maxtime = g_maxtime_default_enc;
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+
+    static char *kwlist[] = {"password", "maxtime", "maxmem", "maxmemfrac", "N", "r", "p", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|dndKII", kwlist,
+                                     &password, &passwordlen,
+                                     &maxtime, &maxmem, &maxmemfrac, &N, &r, &p)) {
+        return -1;
+    }
+    if (parse_params(N, &r, &p, &logN) != 0) {
+        return -1;
+    }
+
+    if (self->lock != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Encryptor is already initialized");
+        return -1;
+    }
+    if ((self->lock = PyThread_allocate_lock()) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    if (logN != 0) {
+        errorcode = scryptenc_stream_init_params(&self->stream, self->buf,
+                                                 (const uint8_t *) password, passwordlen,
+                                                 logN, r, p);
+    } else {
+        errorcode = scryptenc_stream_init(&self->stream, self->buf,
+                                          (const uint8_t *) password, passwordlen,
+                                          maxmem, maxmemfrac, maxtime);
+    }
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_ENCRYPTOR, errorcode);
+
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return -1;
+    }
+    self->buflen = 96;
+    return 0;
+}
+
+static int decryptor_init(ScryptStreamObject *self, PyObject *args, PyObject *kwargs) {
+    const char *password;
+    int passwordlen;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = g_maxmemfrac_default;
+    double maxtime = g_maxtime_default;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+
+    static char *kwlist[] = {"password", "maxtime", "maxmem", "maxmemfrac", "maxN", "maxrp", "maxbytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|dndKKK", kwlist,
+                                     &password, &passwordlen,
+                                     &maxtime, &maxmem, &maxmemfrac,
+                                     &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return -1;
+    }
+
+    if (self->lock != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Decryptor is already initialized");
+        return -1;
+    }
+    if ((self->lock = PyThread_allocate_lock()) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    // the keys can only be derived once the header has arrived
+    if ((self->password = PyMem_Malloc(passwordlen + 1)) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(self->password, password, passwordlen);
+    self->passwordlen = passwordlen;
+    self->maxmem = maxmem;
+    self->maxmemfrac = maxmemfrac;
+    self->maxtime = maxtime;
+    self->ceil = ceil;
+    self->decrypt = 1;
+    return 0;
+}
+
+// take the lock on a stream that is still open; the stream is checked
+// with the lock held, since another thread may finalize it meanwhile
+static int stream_enter(ScryptStreamObject *self) {
+    if (self->lock == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "stream is not initialized");
+        return -1;
+    }
+    ENTER_STREAM(self);
+    if (self->finished) {
+        LEAVE_STREAM(self);
+        PyErr_SetString(PyExc_RuntimeError, "stream has already been finalized");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *encryptor_update(ScryptStreamObject *self, PyObject *args) {
+    const char *input;
+    int inputlen;
+    size_t headerlen;
+    uint8_t *out;
+    PyObject *value;
+
+    if (!PyArg_ParseTuple(args, "s#", &input, &inputlen)) {
+        return NULL;
+    }
+    if (stream_enter(self) != 0) {
+        return NULL;
+    }
+    stats_begin();
+
+    // the header goes in front of the first piece of output
+    headerlen = self->buflen;
+    if ((value = PyBytes_FromStringAndSize(NULL, headerlen + inputlen)) == NULL) {
+        LEAVE_STREAM(self);
+        return NULL;
+    }
+    out = (uint8_t *) PyBytes_AS_STRING(value);
+    memcpy(out, self->buf, headerlen);
+    self->buflen = 0;
+
+    if (inputlen >= STREAM_GIL_MINSIZE) {
+        Py_BEGIN_ALLOW_THREADS;
+        scryptenc_stream_update(self->stream, (const uint8_t *) input,
+                                &out[headerlen], inputlen);
+        Py_END_ALLOW_THREADS;
+    } else {
+        scryptenc_stream_update(self->stream, (const uint8_t *) input,
+                                &out[headerlen], inputlen);
+    }
+
+    LEAVE_STREAM(self);
+    return value;
+}
+
+static PyObject *encryptor_finalize(ScryptStreamObject *self) {
+    uint8_t *out;
+    PyObject *value;
+
+    if (stream_enter(self) != 0) {
+        return NULL;
+    }
+    stats_begin();
+
+    if ((value = PyBytes_FromStringAndSize(NULL, self->buflen + 32)) == NULL) {
+        LEAVE_STREAM(self);
+        return NULL;
+    }
+    out = (uint8_t *) PyBytes_AS_STRING(value);
+    memcpy(out, self->buf, self->buflen);
+    scryptenc_stream_final(self->stream, &out[self->buflen]);
+    self->stream = NULL;
+    self->buflen = 0;
+    self->finished = 1;
+
+    LEAVE_STREAM(self);
+    return value;
+}
+
+static PyObject *decryptor_update(ScryptStreamObject *self, PyObject *args) {
+    const uint8_t *input;
+    int inputlen;
+    size_t take, total, outlen, fromheld;
+    int errorcode;
+    uint8_t *out;
+    PyObject *value;
+
+    if (!PyArg_ParseTuple(args, "s#", (const char **) &input, &inputlen)) {
+        return NULL;
+    }
+    if (stream_enter(self) != 0) {
+        return NULL;
+    }
+    stats_begin();
+
+    // collect the header, and derive the keys once we have all of it
+    if (self->stream == NULL) {
+        take = 96 - self->buflen;
+        if (take > (size_t) inputlen) {
+            take = inputlen;
+        }
+        memcpy(&self->buf[self->buflen], input, take);
+        self->buflen += take;
+        input += take;
+        inputlen -= take;
+        if (self->buflen < 96) {
+            LEAVE_STREAM(self);
+            return PyBytes_FromStringAndSize(NULL, 0);
+        }
+
+        Py_BEGIN_ALLOW_THREADS;
+        errorcode = scryptdec_stream_init_ceil(&self->stream, self->buf,
+                                               self->password, self->passwordlen,
+                                               self->maxmem, self->maxmemfrac, self->maxtime,
+                                               ceilings(&self->ceil));
+        Py_END_ALLOW_THREADS;
+        if (errorcode != 0) {
+            metrics_call(METRICS_DECRYPTOR, errorcode);
+        }
+
+        stream_forget_password(self);
+        self->buflen = 0;
+        if (errorcode != 0) {
+            self->finished = 1;
+            LEAVE_STREAM(self);
+            PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+            return NULL;
+        }
+    }
+
+    // hold back the last 32 bytes, which might be the signature
+    total = self->buflen + inputlen;
+    outlen = total > 32 ? total - 32 : 0;
+    if ((value = PyBytes_FromStringAndSize(NULL, outlen)) == NULL) {
+        LEAVE_STREAM(self);
+        return NULL;
+    }
+    out = (uint8_t *) PyBytes_AS_STRING(value);
+
+    fromheld = outlen < self->buflen ? outlen : self->buflen;
+    if (outlen >= STREAM_GIL_MINSIZE) {
+        Py_BEGIN_ALLOW_THREADS;
+        scryptdec_stream_update(self->stream, self->buf, out, fromheld);
+        scryptdec_stream_update(self->stream, input, &out[fromheld], outlen - fromheld);
+        Py_END_ALLOW_THREADS;
+    } else {
+        scryptdec_stream_update(self->stream, self->buf, out, fromheld);
+        scryptdec_stream_update(self->stream, input, &out[fromheld], outlen - fromheld);
+    }
+
+    memmove(self->buf, &self->buf[fromheld], self->buflen - fromheld);
+    self->buflen -= fromheld;
+    memcpy(&self->buf[self->buflen], &input[outlen - fromheld], total - outlen - self->buflen);
+    self->buflen = total - outlen;
+
+    LEAVE_STREAM(self);
+    return value;
+}
+
+static PyObject *decryptor_finalize(ScryptStreamObject *self) {
+    int errorcode;
+
+    if (stream_enter(self) != 0) {
+        return NULL;
+    }
+    stats_begin();
+
+    self->finished = 1;
+    if (self->stream == NULL || self->buflen < 32) {
+        errorcode = 7;
+    } else {
+        errorcode = scryptdec_stream_final(self->stream, self->buf);
+        self->stream = NULL;
+    }
+
+    LEAVE_STREAM(self);
+
+    metrics_call(METRICS_DECRYPTOR, errorcode);
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize(NULL, 0);
+}
+
+static PyMethodDef EncryptorMethods[] = {
+    { "update", (PyCFunction) encryptor_update, METH_VARARGS,
+      "update(data): bytes; encrypt a chunk of data, returning the header along with the first chunk" },
+    { "finalize", (PyCFunction) encryptor_finalize, METH_NOARGS,
+      "finalize(): bytes; finish encrypting, returning the signature" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyMethodDef DecryptorMethods[] = {
+    { "update", (PyCFunction) decryptor_update, METH_VARARGS,
+      "update(data): bytes; decrypt a chunk of data; the output is unauthenticated until finalize() succeeds" },
+    { "finalize", (PyCFunction) decryptor_finalize, METH_NOARGS,
+      "finalize(): bytes; check the signature at the end of the data" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject EncryptorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "scrypt.Encryptor",
+    sizeof(ScryptStreamObject),
+    0,
+    (destructor) stream_dealloc,
+};
+
+static PyTypeObject DecryptorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "scrypt.Decryptor",
+    sizeof(ScryptStreamObject),
+    0,
+    (destructor) stream_dealloc,
+};
+
+typedef struct {
+    PyObject_HEAD
+    struct scryptenc_session *session;
+    PyThread_type_lock lock;
+    uint8_t header[96];
+    // resumed from a header, so it may only decrypt
+    int resumed;
+} ScryptSessionObject;
+
+static void session_dealloc(ScryptSessionObject *self) {
+    scryptenc_session_free(self->session);
+    if (self->lock != NULL) {
+        PyThread_free_lock(self->lock);
+    }
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int session_init(ScryptSessionObject *self, PyObject *args, PyObject *kwargs) {
+    const char *password, *header = NULL;
+    int passwordlen, headerlen = 0;
+    int errorcode;
+    size_t maxmem = g_maxmem_default;
+    double maxmemfrac = -1;
+    double maxtime = -1;
+    uint64_t N = 0;
+    uint32_t r = 0;
+    uint32_t p = 0;
+    int logN = 0;
+    struct scryptdec_ceilings ceil = { 0, 0, 0 };
+
+    static char *kwlist[] = {"password", "header", "maxtime", "maxmem", "maxmemfrac", "N", "r", "p", "maxN", "maxrp", "maxbytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|z#dndKIIKKK", kwlist,
+                                     &password, &passwordlen, &header, &headerlen,
+                                     &maxtime, &maxmem, &maxmemfrac, &N, &r, &p,
+                                     &ceil.maxN, &ceil.maxrp, &ceil.maxbytes)) {
+        return -1;
+    }
+    if (parse_params(N, &r, &p, &logN) != 0) {
+        return -1;
+    }
+    if (header != NULL && logN != 0) {
+        PyErr_SetString(PyExc_ValueError, "N, r and p can only be given when starting a session");
+        return -1;
+    }
+    if (header == NULL && ceilings(&ceil) != NULL) {
+        PyErr_SetString(PyExc_ValueError, "maxN, maxrp and maxbytes can only be given when resuming a session");
+        return -1;
+    }
+
+    if (header != NULL && headerlen != 96) {
+        PyErr_SetString(PyExc_ValueError, "header must be 96 bytes long");
+        return -1;
+    }
+    if (self->lock != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Session is already initialized");
+        return -1;
+    }
+    if ((self->lock = PyThread_allocate_lock()) == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    // the limits default as for encrypt() when starting a session, and as
+    // for decrypt() when resuming one
+    if (maxtime < 0) {
+        maxtime = header == NULL ? g_maxtime_default_enc : g_maxtime_default;
+    }
+    if (maxmemfrac < 0) {
+        maxmemfrac = header == NULL ? g_maxmemfrac_default_enc : g_maxmemfrac_default;
+    }
+
+    stats_begin();
+    Py_BEGIN_ALLOW_THREADS;
+    if (header == NULL && logN != 0) {
+        errorcode = scryptenc_session_init_params(&self->session, self->header,
+                                                  (const uint8_t *) password, passwordlen,
+                                                  logN, r, p);
+    } else if (header == NULL) {
+        errorcode = scryptenc_session_init(&self->session, self->header,
+                                           (const uint8_t *) password, passwordlen,
+                                           maxmem, maxmemfrac, maxtime);
+    } else {
+        memcpy(self->header, header, 96);
+        self->resumed = 1;
+        errorcode = scryptdec_session_init_ceil(&self->session, self->header,
+                                                (const uint8_t *) password, passwordlen,
+                                                maxmem, maxmemfrac, maxtime, ceilings(&ceil));
+    }
+    Py_END_ALLOW_THREADS;
+    metrics_call(METRICS_SESSION, errorcode);
+
+    if (errorcode != 0) {
+        self->session = NULL;
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return -1;
+    }
+    return 0;
+}
+
+static int session_check(ScryptSessionObject *self) {
+    if (self->session == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "session is not initialized");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *session_encrypt(ScryptSessionObject *self, PyObject *args) {
+    const char *input;
+    int inputlen;
+    int errorcode;
+    PyObject *value;
+
+    if (!PyArg_ParseTuple(args, "s#", &input, &inputlen)) {
+        return NULL;
+    }
+    if (session_check(self) != 0) {
+        return NULL;
+    }
+    if (self->resumed) {
+        // it can't know which nonces the session's creator has used
+        PyErr_SetString(PyExc_RuntimeError, "a resumed session can only decrypt");
+        return NULL;
+    }
+    if ((value = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) inputlen + 40)) == NULL) {
+        return NULL;
+    }
+
+    ENTER_STREAM(self);
+    stats_begin();
+    if (inputlen >= STREAM_GIL_MINSIZE) {
+        Py_BEGIN_ALLOW_THREADS;
+        errorcode = scryptenc_session_seal(self->session, (const uint8_t *) input, inputlen,
+                                           (uint8_t *) PyBytes_AS_STRING(value));
+        Py_END_ALLOW_THREADS;
+    } else {
+        errorcode = scryptenc_session_seal(self->session, (const uint8_t *) input, inputlen,
+                                           (uint8_t *) PyBytes_AS_STRING(value));
+    }
+    LEAVE_STREAM(self);
+    metrics_call(METRICS_SESSION_ENCRYPT, errorcode);
+
+    if (errorcode != 0) {
+        Py_DECREF(value);
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+        return NULL;
+    }
+    return value;
+}
+
+static PyObject *session_decrypt(ScryptSessionObject *self, PyObject *args) {
+    const char *input;
+    int inputlen;
+    size_t outputlen;
+    int errorcode;
+    uint8_t *outbuf;
+    PyObject *value = NULL;
+
+    if (!PyArg_ParseTuple(args, "s#", &input, &inputlen)) {
+        return NULL;
+    }
+    if (session_check(self) != 0) {
+        return NULL;
+    }
+    if ((outbuf = PyMem_Malloc(inputlen + 1)) == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    stats_begin();
+    // opening a record does not change the session, so needs no lock
+    if (inputlen >= STREAM_GIL_MINSIZE) {
+        Py_BEGIN_ALLOW_THREADS;
+        errorcode = scryptdec_session_open(self->session, (const uint8_t *) input, inputlen,
+                                           outbuf, &outputlen);
+        Py_END_ALLOW_THREADS;
+    } else {
+        errorcode = scryptdec_session_open(self->session, (const uint8_t *) input, inputlen,
+                                           outbuf, &outputlen);
+    }
+
+    metrics_call(METRICS_SESSION_DECRYPT, errorcode);
+    if (errorcode != 0) {
+        PyErr_Format(ScryptError, "%s", g_error_codes[errorcode]);
+    } else {
+        value = PyBytes_FromStringAndSize((const char *) outbuf, outputlen);
+    }
+    memset(outbuf, 0, inputlen);
+    PyMem_Free(outbuf);
+    return value;
+}
+
+static PyObject *session_get_header(ScryptSessionObject *self, void *closure) {
+    if (session_check(self) != 0) {
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize((const char *) self->header, 96);
+}
+
+static PyMethodDef SessionMethods[] = {
+    { "encrypt", (PyCFunction) session_encrypt, METH_VARARGS,
+      "encrypt(data): bytes; encrypt and sign a record under a fresh nonce; not allowed on a resumed session" },
+    { "decrypt", (PyCFunction) session_decrypt, METH_VARARGS,
+      "decrypt(record): bytes; check and decrypt a record" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef SessionGetSet[] = {
+    { "header", (getter) session_get_header, NULL,
+      "the 96-byte header needed to resume the session", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject SessionType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "scrypt.Session",
+    sizeof(ScryptSessionObject),
+    0,
+    (destructor) session_dealloc,
+};
+
+static int stream_types_ready(void) {
+    EncryptorType.tp_flags = Py_TPFLAGS_DEFAULT;
+    EncryptorType.tp_doc = "Encryptor(password, maxtime=5.0, maxmem=0, maxmemfrac=0.125, N=None, r=8, p=1); encrypt data incrementally, with the given N, r and p if N is given";
+    EncryptorType.tp_methods = EncryptorMethods;
+    EncryptorType.tp_init = (initproc) encryptor_init;
+    EncryptorType.tp_new = PyType_GenericNew;
+
+    DecryptorType.tp_flags = Py_TPFLAGS_DEFAULT;
+    DecryptorType.tp_doc = "Decryptor(password, maxtime=300.0, maxmem=0, maxmemfrac=0.5, maxN=0, maxrp=0, maxbytes=0); decrypt data incrementally";
+    DecryptorType.tp_methods = DecryptorMethods;
+    DecryptorType.tp_init = (initproc) decryptor_init;
+    DecryptorType.tp_new = PyType_GenericNew;
+
+    SessionType.tp_flags = Py_TPFLAGS_DEFAULT;
+    SessionType.tp_doc = "Session(password, header=None, maxtime=5.0 or 300.0, maxmem=0, maxmemfrac=0.125 or 0.5, N=None, r=8, p=1, maxN=0, maxrp=0, maxbytes=0); derive a key once and encrypt many records with it, with the given N, r and p if N is given, or resume it from header within the ceilings maxN, maxrp and maxbytes";
+    SessionType.tp_methods = SessionMethods;
+    SessionType.tp_getset = SessionGetSet;
+    SessionType.tp_init = (initproc) session_init;
+    SessionType.tp_new = PyType_GenericNew;
+
+    if (PyType_Ready(&EncryptorType) < 0 || PyType_Ready(&DecryptorType) < 0 ||
+        PyType_Ready(&SessionType) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static PyMethodDef ScryptMethods[] = {
+    { "encrypt", (PyCFunction) scrypt_encrypt, METH_VARARGS | METH_KEYWORDS,
+      "encrypt(input, password, maxtime=5.0, maxmem=0, maxmemfrac=0.125, segmented=False, N=None, r=8, p=1): str; encrypt a string, with the given N, r and p if N is given" },
+    { "decrypt", (PyCFunction) scrypt_decrypt, METH_VARARGS | METH_KEYWORDS,
+      "decrypt(input, password, maxtime=300.0, maxmem=0, maxmemfrac=0.5, maxN=0, maxrp=0, maxbytes=0): str; decrypt a string, refusing parameters above the ceilings maxN, maxrp and maxbytes; with all three given, nothing is timed" },
+    { "decrypt_range", (PyCFunction) scrypt_decrypt_range, METH_VARARGS | METH_KEYWORDS,
+      "decrypt_range(input, password, offset, length, maxtime=300.0, maxmem=0, maxmemfrac=0.5, maxN=0, maxrp=0, maxbytes=0): bytes; decrypt part of a segmented string" },
+    { "decrypt_stream_range", (PyCFunction) scrypt_decrypt_stream_range, METH_VARARGS | METH_KEYWORDS,
+      "decrypt_stream_range(infile, password, offset, length, maxtime=300.0, maxmem=0, maxmemfrac=0.5, maxN=0, maxrp=0, maxbytes=0): bytes; decrypt part of a segmented file object or descriptor, reading only the segments needed" },
+    { "inspect", (PyCFunction) scrypt_inspect, METH_VARARGS | METH_KEYWORDS,
+      "inspect(input): (logN, r, p, salt, memory, ops); read the parameters of encrypted data without decrypting it" },
+    { "encrypt_stream", (PyCFunction) scrypt_encrypt_stream, METH_VARARGS | METH_KEYWORDS,
+      "encrypt_stream(infile, outfile, password, maxtime=5.0, maxmem=0, maxmemfrac=0.125, N=None, r=8, p=1): None; encrypt a file object or descriptor, with the given N, r and p if N is given" },
+    { "decrypt_stream", (PyCFunction) scrypt_decrypt_stream, METH_VARARGS | METH_KEYWORDS,
+      "decrypt_stream(infile, outfile, password, maxtime=300.0, maxmem=0, maxmemfrac=0.5, spool=-1, maxN=0, maxrp=0, maxbytes=0): None; decrypt a file object or descriptor, authenticating it all before writing if spool >= 0" },
+    { "encrypt_file", (PyCFunction) scrypt_encrypt_file, METH_VARARGS | METH_KEYWORDS,
+      "encrypt_file(path_in, path_out, password, maxtime=5.0, maxmem=0, maxmemfrac=0.125, N=None, r=8, p=1): None; encrypt the file path_in to path_out, with the given N, r and p if N is given" },
+    { "decrypt_file", (PyCFunction) scrypt_decrypt_file, METH_VARARGS | METH_KEYWORDS,
+      "decrypt_file(path_in, path_out, password, maxtime=300.0, maxmem=0, maxmemfrac=0.5, maxN=0, maxrp=0, maxbytes=0): None; decrypt the file path_in to path_out" },
+    { "encrypt_files", (PyCFunction) scrypt_encrypt_files, METH_VARARGS | METH_KEYWORDS,
+      "encrypt_files(paths, password, maxtime=5.0, maxmem=0, maxmemfrac=0.125, threads=0, N=None, r=8, p=1): list; encrypt each (path_in, path_out) pair, returning None or the error for each" },
+    { "hash", (PyCFunction) scrypt_hash, METH_VARARGS | METH_KEYWORDS,
+      "hash(password, salt, N=2**14, r=8, p=1, buflen=64): str; compute a buflen-byte scrypt hash" },
+    { "verify", (PyCFunction) scrypt_verify, METH_VARARGS | METH_KEYWORDS,
+      "verify(password, salt, expected, N=2**14, r=8, p=1): bool; check a scrypt hash in constant time" },
+    { "random_salt", (PyCFunction) scrypt_random_salt, METH_VARARGS | METH_KEYWORDS,
+      "random_salt(n=32): str; return n random bytes from the operating system" },
+    { "set_salt_pool", (PyCFunction) scrypt_set_salt_pool, METH_VARARGS,
+      "set_salt_pool(enabled): None; serve salts from a per-thread buffer of random bytes" },
+    { "set_threads", (PyCFunction) scrypt_set_threads, METH_VARARGS,
+      "set_threads(nthreads): None; set the number of threads decrypting segmented data, 0 for one per CPU" },
+    { "set_blocksize", (PyCFunction) scrypt_set_blocksize, METH_VARARGS,
+      "set_blocksize(blocksize): None; set the block size used by encrypt_stream and decrypt_stream, 0 for 64 kiB, at most 64 MiB" },
+    { "set_key_cache", (PyCFunction) scrypt_set_key_cache, METH_VARARGS | METH_KEYWORDS,
+      "set_key_cache(maxentries, ttl=0.0): None; cache up to maxentries derived keys in locked memory for ttl seconds (0 for no limit); 0 entries disables the cache" },
+    { "clear_key_cache", (PyCFunction) scrypt_clear_key_cache, METH_NOARGS,
+      "clear_key_cache(): None; wipe all cached derived keys" },
+    { "enable_stats", (PyCFunction) scrypt_enable_stats, METH_VARARGS,
+      "enable_stats(enabled): None; record the time spent in each phase of key derivation and encryption" },
+    { "last_stats", (PyCFunction) scrypt_last_stats, METH_NOARGS,
+      "last_stats(): dict; per-phase statistics of the last call made by this thread" },
+    { "stats", (PyCFunction) scrypt_stats, METH_NOARGS,
+      "stats(): dict; per-phase statistics of all calls since the last reset_stats" },
+    { "reset_stats", (PyCFunction) scrypt_reset_stats, METH_NOARGS,
+      "reset_stats(): None; zero the statistics returned by stats" },
+    { "metrics", (PyCFunction) scrypt_metrics, METH_NOARGS,
+      "metrics(): dict; process-wide counts of calls by outcome, key derivation latency histograms by (N, r, p), bytes encrypted and decrypted, memory in use and calibration runs" },
+    { "mcf_hash", (PyCFunction) scrypt_mcf_hash, METH_VARARGS | METH_KEYWORDS,
+      "mcf_hash(password, N=2**14, r=8, p=1): str; hash a password with a random salt into a $7$ string" },
+    { "mcf_verify", (PyCFunction) scrypt_mcf_verify, METH_VARARGS | METH_KEYWORDS,
+      "mcf_verify(password, mcf): bool; check a password against a $7$ string" },
+    { "needs_rehash", (PyCFunction) scrypt_needs_rehash, METH_VARARGS | METH_KEYWORDS,
+      "needs_rehash(mcf, N=2**14, r=8, p=1): bool; check whether a $7$ string uses other parameters" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef scryptmodule = {
+    PyModuleDef_HEAD_INIT,
+    "scrypt",
+    NULL,
+    -1,
+    ScryptMethods
+};
+
+PyMODINIT_FUNC PyInit_scrypt(void) {
+    PyObject *m;
+
+    if (stream_types_ready() < 0) {
+        return NULL;
+    }
+
+    m = PyModule_Create(&scryptmodule);
+
+    if (m == NULL) {
+        return NULL;
+    }
+
+    ScryptError = PyErr_NewException("scrypt.error", NULL, NULL);
+    Py_INCREF(ScryptError);
     PyModule_AddObject(m, "error", ScryptError);
+
+    Py_INCREF(&EncryptorType);
+    PyModule_AddObject(m, "Encryptor", (PyObject *) &EncryptorType);
+    Py_INCREF(&DecryptorType);
+    PyModule_AddObject(m, "Decryptor", (PyObject *) &DecryptorType);
+    Py_INCREF(&SessionType);
+    PyModule_AddObject(m, "Session", (PyObject *) &SessionType);
     return m;
 }
@@ -1,7 +1,74 @@
+import binascii
+import errno
+import hashlib
+import os
+import random
+import shutil
+import struct
+import sys
+import tempfile
+import threading
+import time
 import unittest
 
 import scrypt
 
+
+# A slow but straightforward scrypt, per RFC 7914, to check the C code
+# against.
+
+def _pbkdf2(password, salt, dklen, c=1):
+    return hashlib.pbkdf2_hmac('sha256', password, salt, c, dklen)
+
+def _salsa20_8(B):
+    def R(a, b):
+        a &= 0xffffffff
+        return ((a << b) | (a >> (32 - b))) & 0xffffffff
+    x = list(B)
+    for i in range(4):
+        x[ 4] ^= R(x[ 0]+x[12], 7);  x[ 8] ^= R(x[ 4]+x[ 0], 9)
+        x[12] ^= R(x[ 8]+x[ 4],13);  x[ 0] ^= R(x[12]+x[ 8],18)
+        x[ 9] ^= R(x[ 5]+x[ 1], 7);  x[13] ^= R(x[ 9]+x[ 5], 9)
+        x[ 1] ^= R(x[13]+x[ 9],13);  x[ 5] ^= R(x[ 1]+x[13],18)
+        x[14] ^= R(x[10]+x[ 6], 7);  x[ 2] ^= R(x[14]+x[10], 9)
+        x[ 6] ^= R(x[ 2]+x[14],13);  x[10] ^= R(x[ 6]+x[ 2],18)
+        x[ 3] ^= R(x[15]+x[11], 7);  x[ 7] ^= R(x[ 3]+x[15], 9)
+        x[11] ^= R(x[ 7]+x[ 3],13);  x[15] ^= R(x[11]+x[ 7],18)
+        x[ 1] ^= R(x[ 0]+x[ 3], 7);  x[ 2] ^= R(x[ 1]+x[ 0], 9)
+        x[ 3] ^= R(x[ 2]+x[ 1],13);  x[ 0] ^= R(x[ 3]+x[ 2],18)
+        x[ 6] ^= R(x[ 5]+x[ 4], 7);  x[ 7] ^= R(x[ 6]+x[ 5], 9)
+        x[ 4] ^= R(x[ 7]+x[ 6],13);  x[ 5] ^= R(x[ 4]+x[ 7],18)
+        x[11] ^= R(x[10]+x[ 9], 7);  x[ 8] ^= R(x[11]+x[10], 9)
+        x[ 9] ^= R(x[ 8]+x[11],13);  x[10] ^= R(x[ 9]+x[ 8],18)
+        x[12] ^= R(x[15]+x[14], 7);  x[13] ^= R(x[12]+x[15], 9)
+        x[14] ^= R(x[13]+x[12],13);  x[15] ^= R(x[14]+x[13],18)
+    return [(x[i] + B[i]) & 0xffffffff for i in range(16)]
+
+def _blockmix(B, r):
+    X = B[-16:]
+    Y = []
+    for i in range(2 * r):
+        X = _salsa20_8([a ^ b for a, b in zip(X, B[16*i:16*i+16])])
+        Y.append(X)
+    return sum(Y[0::2], []) + sum(Y[1::2], [])
+
+def _smix(B, r, N):
+    X = list(struct.unpack('<%dI' % (32 * r), B))
+    V = []
+    for i in range(N):
+        V.append(X)
+        X = _blockmix(X, r)
+    for i in range(N):
+        j = X[-16] % N
+        X = _blockmix([a ^ b for a, b in zip(X, V[j])], r)
+    return struct.pack('<%dI' % (32 * r), *X)
+
+def _scrypt(password, salt, N, r, p, dklen):
+    B = _pbkdf2(password, salt, 128 * r * p)
+    B = b''.join(_smix(B[128*r*i:128*r*(i+1)], r, N) for i in range(p))
+    return _pbkdf2(password, B, dklen)
+
+
 class TestScrypt(unittest.TestCase):
     def test_encrypt(self):
         s = scrypt.encrypt('message', 'password', .1)
@@ -17,6 +84,538 @@ class TestScrypt(unittest.TestCase):
         orig_m = 'message'
         s = scrypt.encrypt(orig_m, 'password', .1)
         self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', .01))
+
+    def test_encrypt_decrypt_stream(self):
+        orig_m = b'message' * 20000
+        plain, enc, dec = [tempfile.TemporaryFile() for i in range(3)]
+        plain.write(orig_m)
+        plain.seek(0)
+        scrypt.encrypt_stream(plain, enc, 'password', .1)
+        enc.seek(0)
+        self.assertEqual(len(enc.read()), 128+len(orig_m))
+        enc.seek(0)
+        scrypt.decrypt_stream(enc.fileno(), dec.fileno(), 'password', 5)
+        dec.seek(0)
+        self.assertEqual(dec.read(), orig_m)
+        enc.seek(0)
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(enc, dec, 'wrong password', 5))
+
+    def test_stream_blocksize(self):
+        orig_m = (b'message' * 30000)[:200003]
+        try:
+            for blocksize in (1, 31, 1000, 1 << 20):
+                scrypt.set_blocksize(blocksize)
+                plain, enc, dec = [tempfile.TemporaryFile() for i in range(3)]
+                plain.write(orig_m)
+                plain.seek(0)
+                scrypt.encrypt_stream(plain, enc, 'password', .01)
+                enc.seek(0)
+                self.assertEqual(len(enc.read()), 128+len(orig_m))
+                enc.seek(0)
+                scrypt.decrypt_stream(enc, dec, 'password', 5)
+                dec.seek(0)
+                self.assertEqual(dec.read(), orig_m)
+                enc.truncate(100)
+                enc.seek(0)
+                self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(enc, dec, 'password', 5))
+            self.assertRaises(ValueError, lambda: scrypt.set_blocksize(-1))
+            self.assertRaises(ValueError, lambda: scrypt.set_blocksize(64 * 2**20 + 1))
+        finally:
+            scrypt.set_blocksize(0)
+
+    def test_decrypt_stream_spool(self):
+        orig_m = (b'message' * 30000)[:200003]
+        for segmented in (False, True):
+            enc = tempfile.TemporaryFile()
+            enc.write(scrypt.encrypt(orig_m, 'password', .01, segmented=segmented))
+            for spool in (0, 1000, 1 << 20):
+                dec = tempfile.TemporaryFile()
+                enc.seek(0)
+                scrypt.decrypt_stream(enc, dec, 'password', 5, spool=spool)
+                dec.seek(0)
+                self.assertEqual(dec.read(), orig_m)
+                # nothing is written unless the whole input checks out
+                dec = tempfile.TemporaryFile()
+                enc.seek(0)
+                self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(enc, dec, 'wrong password', 5, spool=spool))
+                enc.seek(-1, 2)
+                last = enc.read(1)
+                enc.seek(-1, 2)
+                enc.write(bytearray([ord(last) ^ 1]))
+                enc.seek(0)
+                self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(enc, dec, 'password', 5, spool=spool))
+                enc.seek(-1, 2)
+                enc.write(last)
+                dec.seek(0, 2)
+                self.assertEqual(dec.tell(), 0)
+
+    def test_encrypt_decrypt_file(self):
+        orig_m = b'message' * 20000
+        d = tempfile.mkdtemp()
+        try:
+            plain, enc, dec = [os.path.join(d, name) for name in ('plain', 'enc', 'dec')]
+            with open(plain, 'wb') as f:
+                f.write(orig_m)
+            scrypt.encrypt_file(plain, enc, 'password', .1)
+            with open(enc, 'rb') as f:
+                self.assertEqual(len(f.read()), 128+len(orig_m))
+            scrypt.decrypt_file(enc, dec, 'password', 5)
+            with open(dec, 'rb') as f:
+                self.assertEqual(f.read(), orig_m)
+            os.remove(dec)
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt_file(enc, dec, 'wrong password', 5))
+            self.assertEqual(sorted(os.listdir(d)), ['enc', 'plain'])
+            # segmented data, and an empty file which cannot be mapped
+            with open(enc, 'wb') as f:
+                f.write(scrypt.encrypt(orig_m, 'password', .01, segmented=True))
+            scrypt.decrypt_file(enc, dec, 'password', 5)
+            with open(dec, 'rb') as f:
+                self.assertEqual(f.read(), orig_m)
+            open(plain, 'wb').close()
+            scrypt.encrypt_file(plain, enc, 'password', .01)
+            scrypt.decrypt_file(enc, dec, 'password', 5)
+            self.assertEqual(os.path.getsize(dec), 0)
+            self.assertRaises(scrypt.error, lambda: scrypt.encrypt_file(os.path.join(d, 'missing'), enc, 'password', .01))
+        finally:
+            shutil.rmtree(d)
+
+    def test_encrypt_files(self):
+        d = tempfile.mkdtemp()
+        try:
+            sizes = [0, 1, 65536, 200003] * 20
+            pairs = []
+            for i, size in enumerate(sizes):
+                path = os.path.join(d, str(i))
+                with open(path, 'wb') as f:
+                    f.write(os.urandom(size))
+                pairs.append((path, path + '.enc'))
+            pairs.append((os.path.join(d, 'missing'), os.path.join(d, 'missing.enc')))
+            results = scrypt.encrypt_files(pairs, 'password', .01, threads=2)
+            self.assertEqual(results[:-1], [None] * len(sizes))
+            self.assertTrue(isinstance(results[-1], scrypt.error))
+            self.assertFalse(os.path.exists(pairs[-1][1]))
+            for path, encpath in pairs[:-1]:
+                scrypt.decrypt_file(encpath, path + '.dec', 'password', 5)
+                with open(path, 'rb') as f, open(path + '.dec', 'rb') as g:
+                    self.assertEqual(f.read(), g.read())
+            self.assertEqual(scrypt.encrypt_files([], 'password'), [])
+            # pairs may be lists, and any iterable of them is accepted
+            path = pairs[0][0]
+            results = scrypt.encrypt_files(iter([[path, path + '.enc2']]), 'password', .01)
+            self.assertEqual(results, [None])
+            self.assertRaises(TypeError, scrypt.encrypt_files, [path], 'password')
+        finally:
+            shutil.rmtree(d)
+
+    def test_encryptor_decryptor(self):
+        orig_m = b'message' * 20000
+        enc = scrypt.Encryptor('password', .1)
+        chunks = [enc.update(orig_m[i:i+5000]) for i in range(0, len(orig_m), 5000)]
+        s = b''.join(chunks) + enc.finalize()
+        self.assertEqual(len(s), 128+len(orig_m))
+        self.assertEqual(scrypt.decrypt(s, 'password', 5), orig_m.decode('ascii'))
+
+        dec = scrypt.Decryptor('password', 5)
+        m = b''.join(dec.update(s[i:i+7]) for i in range(0, 301, 7))
+        m += dec.update(s[301:])
+        dec.finalize()
+        self.assertEqual(m, orig_m)
+
+        dec = scrypt.Decryptor('password', 5)
+        dec.update(s[:-1])
+        self.assertRaises(scrypt.error, dec.finalize)
+        dec = scrypt.Decryptor('wrong password', 5)
+        self.assertRaises(scrypt.error, lambda: dec.update(s))
+
+    def test_stream_threads(self):
+        # updates racing a finalize from another thread must fail cleanly
+        big = b'x' * (1 << 20)
+        s = scrypt.encrypt(b'', 'password', .01)
+        def hammer(obj, data):
+            try:
+                for i in range(10):
+                    obj.update(data)
+            except (RuntimeError, scrypt.error):
+                pass
+        for i in range(5):
+            enc = scrypt.Encryptor('password', .01)
+            dec = scrypt.Decryptor('password', 5)
+            threads = [threading.Thread(target=hammer, args=(enc, big)) for j in range(3)]
+            threads += [threading.Thread(target=hammer, args=(dec, s[:96])) for j in range(3)]
+            for t in threads:
+                t.start()
+            enc.finalize()
+            self.assertRaises(scrypt.error, dec.finalize)
+            for t in threads:
+                t.join()
+            self.assertRaises(RuntimeError, lambda: enc.update(b'x'))
+            self.assertRaises(RuntimeError, lambda: dec.update(b'x'))
+
+    def test_hash_vector(self):
+        h = scrypt.hash('', '', N=16, r=1, p=1)
+        self.assertEqual(binascii.hexlify(h),
+                         b'77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442'
+                         b'fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906')
+
+    def test_hash_buflen(self):
+        h = scrypt.hash('password', 'salt', N=16, r=1, p=1)
+        self.assertEqual(len(h), 64)
+        h96 = scrypt.hash('password', 'salt', N=16, r=1, p=1, buflen=96)
+        self.assertEqual(len(h96), 96)
+        self.assertEqual(h96[:64], h)
+        self.assertRaises(scrypt.error, lambda: scrypt.hash('password', 'salt', buflen=0))
+
+    def test_rfc7914_vectors(self):
+        # the 1 GiB vector with N=2**20 is left out
+        h = scrypt.hash('password', 'NaCl', N=1024, r=8, p=16)
+        self.assertEqual(binascii.hexlify(h),
+                         b'fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162'
+                         b'2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640')
+        h = scrypt.hash('pleaseletmein', 'SodiumChloride', N=16384, r=8, p=1)
+        self.assertEqual(binascii.hexlify(h),
+                         b'7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2'
+                         b'd5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887')
+
+    def test_reference(self):
+        # the PBKDF2-HMAC-SHA256 vectors of RFC 7914 and the smallest scrypt
+        # one, to check the reference used by test_differential
+        self.assertEqual(binascii.hexlify(_pbkdf2(b'passwd', b'salt', 64)),
+                         b'55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc'
+                         b'49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783')
+        self.assertEqual(binascii.hexlify(_pbkdf2(b'Password', b'NaCl', 64, 80000)),
+                         b'4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56'
+                         b'a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d')
+        self.assertEqual(_scrypt(b'', b'', 16, 1, 1, 64), scrypt.hash('', '', N=16, r=1, p=1))
+
+    def test_differential(self):
+        # the same cases every run, unless SCRYPT_TEST_SEED picks others
+        seed = int(os.environ.get('SCRYPT_TEST_SEED', 7914))
+        rnd = random.Random(seed)
+        def randbytes(n):
+            return struct.pack('%dB' % n, *[rnd.randint(0, 255) for i in range(n)])
+        for i in range(60):
+            N = 2 ** rnd.randint(1, 12 if hasattr(hashlib, 'scrypt') else 5)
+            r = rnd.randint(1, 4)
+            p = rnd.randint(1, 3)
+            password = randbytes(rnd.randint(0, 80))
+            salt = randbytes(rnd.randint(0, 80))
+            buflen = rnd.randint(1, 200)
+            if hasattr(hashlib, 'scrypt'):
+                expected = hashlib.scrypt(password, salt=salt, n=N, r=r, p=p,
+                                          dklen=buflen, maxmem=2**26)
+            else:
+                expected = _scrypt(password, salt, N, r, p, buflen)
+            # with and without the timing instrumentation
+            for stats in (False, True):
+                scrypt.enable_stats(stats)
+                try:
+                    h = scrypt.hash(password, salt, N=N, r=r, p=p, buflen=buflen)
+                finally:
+                    scrypt.enable_stats(False)
+                self.assertEqual(h, expected, 'seed %d, N=%d r=%d p=%d' % (seed, N, r, p))
+            if i < 10:
+                self.assertEqual(_scrypt(password, salt, min(N, 16), r, p, buflen),
+                                 scrypt.hash(password, salt, N=min(N, 16), r=r, p=p, buflen=buflen))
+
+    def test_segmented(self):
+        orig_m = 'message' * 30000
+        s = scrypt.encrypt(orig_m, 'password', .1, segmented=True)
+        self.assertEqual(len(s), 96+len(orig_m)+32*4)
+        self.assertEqual(scrypt.decrypt(s, 'password', 5), orig_m)
+        orig_b = orig_m.encode('ascii')
+        for offset, length in [(0, 10), (65530, 20), (65536, 65536), (100, 200000), (209990, 100), (300000, 5)]:
+            m = scrypt.decrypt_range(s, 'password', offset, length, 5)
+            self.assertEqual(m, orig_b[offset:offset+length])
+        # from a file, only the segments needed are read, and corruption
+        # elsewhere goes unnoticed
+        f = tempfile.TemporaryFile()
+        f.write(s[:-10] + b'x' * 10)
+        f.seek(5)
+        for offset, length in [(0, 10), (65530, 20), (100, 100000), (300000, 5)]:
+            m = scrypt.decrypt_stream_range(f, 'password', offset, length, 5)
+            self.assertEqual(m, orig_b[offset:offset+length])
+        self.assertEqual(f.tell(), 5)
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream_range(f, 'password', 209990, 100, 5))
+        f.truncate(96+65536+32+100)
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream_range(f.fileno(), 'password', 65536, 10, 5))
+        f.close()
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s[:-1], 'password', 5))
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s[:96+65536+32], 'password', 5))
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt_range(scrypt.encrypt('message', 'password', .1), 'password', 0, 1, 5))
+
+    def test_segmented_threads(self):
+        orig_m = b'message' * 200000
+        s = scrypt.encrypt(orig_m, 'password', .1, segmented=True)
+        scrypt.set_threads(4)
+        try:
+            self.assertEqual(scrypt.decrypt(s, 'password', 5), orig_m.decode('ascii'))
+            enc, dec = tempfile.TemporaryFile(), tempfile.TemporaryFile()
+            enc.write(s)
+            enc.seek(0)
+            scrypt.decrypt_stream(enc, dec, 'password', 5)
+            dec.seek(0)
+            self.assertEqual(dec.read(), orig_m)
+            bad = s[:1000] + b'x' + s[1001:]
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(bad, 'password', 5))
+            enc.seek(0)
+            enc.write(bad)
+            enc.seek(0)
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(enc, dec, 'password', 5))
+            enc.close()
+            dec.close()
+        finally:
+            scrypt.set_threads(0)
+
+    def test_key_cache(self):
+        s = scrypt.encrypt('message', 'password', .1)
+        scrypt.set_key_cache(4)
+        try:
+            self.assertEqual(scrypt.decrypt(s, 'password', 5), 'message')
+            # with the key cached, even maxtime=0 is enough
+            self.assertEqual(scrypt.decrypt(s, 'password', 0), 'message')
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'wrong password', 5))
+            scrypt.clear_key_cache()
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', 0))
+            scrypt.set_key_cache(4, ttl=.2)
+            self.assertEqual(scrypt.decrypt(s, 'password', 5), 'message')
+            self.assertEqual(scrypt.decrypt(s, 'password', 0), 'message')
+            time.sleep(.3)
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', 0))
+            with self.assertRaises(OSError) as cm:
+                scrypt.set_key_cache(sys.maxsize)
+            self.assertEqual(cm.exception.errno, errno.ENOMEM)
+        finally:
+            scrypt.set_key_cache(0)
+
+    def test_session(self):
+        sess = scrypt.Session('password', maxtime=.1)
+        records = [sess.encrypt(m) for m in [b'', b'message', b'message' * 1000]]
+        self.assertEqual([len(r) for r in records], [40, 47, 7040])
+        self.assertNotEqual(sess.encrypt(b'message')[8:], records[1][8:])
+        other = scrypt.Session('password', sess.header, maxtime=5)
+        self.assertEqual([other.decrypt(r) for r in records], [b'', b'message', b'message' * 1000])
+        self.assertRaises(scrypt.error, lambda: other.decrypt(records[1][:-1]))
+        # the nonces the original session used are unknown here
+        self.assertRaises(RuntimeError, lambda: other.encrypt(b'message'))
+        self.assertRaises(scrypt.error, lambda: scrypt.Session('wrong password', sess.header, maxtime=5))
+        self.assertRaises(scrypt.error, lambda: scrypt.Session('password', scrypt.encrypt('message', 'password', .1)[:96], maxtime=5))
+
+    def test_inspect(self):
+        s = scrypt.encrypt('message', 'password', .1)
+        logN, r, p, salt, mem, ops = scrypt.inspect(s)
+        self.assertEqual((r, len(salt)), (8, 32))
+        self.assertEqual(mem, 128 * r * 2**logN)
+        self.assertEqual(ops, 4 * 2**logN * r * p)
+        self.assertEqual(scrypt.inspect(s[:96]), scrypt.inspect(s))
+        self.assertEqual(scrypt.inspect(scrypt.encrypt('message', 'password', .1, segmented=True))[1], 8)
+        self.assertRaises(scrypt.error, lambda: scrypt.inspect(s[:95]))
+        self.assertRaises(scrypt.error, lambda: scrypt.inspect(s[:20] + b'x' + s[21:]))
+        # a valid checksum does not make r = 0 or p = 0 acceptable
+        for r, p in ((0, 1), (1, 0)):
+            header = b'scrypt\x00' + struct.pack('>BII', 4, r, p) + b'\x00' * 32
+            header += hashlib.sha256(header).digest()[:16] + b'\x00' * 32
+            self.assertRaises(scrypt.error, lambda: scrypt.inspect(header))
+
+    def test_encrypt_params(self):
+        s = scrypt.encrypt('message', 'password', N=16, r=2, p=3)
+        self.assertEqual(len(s), 128+len('message'))
+        self.assertEqual(scrypt.inspect(s)[:3], (4, 2, 3))
+        self.assertEqual(scrypt.decrypt(s, 'password', 5), 'message')
+        s = scrypt.encrypt('message', 'password', N=16, segmented=True)
+        self.assertEqual(scrypt.inspect(s)[:3], (4, 8, 1))
+        self.assertEqual(scrypt.decrypt(s, 'password', 5), 'message')
+        self.assertRaises(scrypt.error, lambda: scrypt.encrypt('message', 'password', N=15))
+        self.assertRaises(ValueError, lambda: scrypt.encrypt('message', 'password', r=2))
+        # every other way of encrypting takes them too
+        enc = scrypt.Encryptor('password', N=16, r=2, p=3)
+        s = enc.update(b'message') + enc.finalize()
+        self.assertEqual(scrypt.inspect(s)[:3], (4, 2, 3))
+        plain, out = tempfile.TemporaryFile(), tempfile.TemporaryFile()
+        plain.write(b'message')
+        plain.seek(0)
+        scrypt.encrypt_stream(plain, out, 'password', N=16, r=2, p=3)
+        out.seek(0)
+        self.assertEqual(scrypt.inspect(out.read())[:3], (4, 2, 3))
+        d = tempfile.mkdtemp()
+        try:
+            paths = [os.path.join(d, name) for name in ('plain', 'enc1', 'enc2')]
+            with open(paths[0], 'wb') as f:
+                f.write(b'message')
+            scrypt.encrypt_file(paths[0], paths[1], 'password', N=16, r=2, p=3)
+            self.assertEqual(scrypt.encrypt_files([(paths[0], paths[2])], 'password', N=16, r=2, p=3), [None])
+            for path in paths[1:]:
+                with open(path, 'rb') as f:
+                    self.assertEqual(scrypt.inspect(f.read())[:3], (4, 2, 3))
+        finally:
+            shutil.rmtree(d)
+        sess = scrypt.Session('password', N=16, r=2, p=3)
+        self.assertEqual(scrypt.inspect(sess.header)[:3], (4, 2, 3))
+        self.assertRaises(ValueError, lambda: scrypt.Session('password', sess.header, N=16))
+        self.assertRaises(scrypt.error, lambda: scrypt.Encryptor('password', N=15))
+
+    def test_decrypt_ceilings(self):
+        s = scrypt.encrypt('message', 'password', N=1024, r=4, p=2)
+        self.assertEqual(scrypt.decrypt(s, 'password', maxN=1024), 'message')
+        self.assertEqual(scrypt.decrypt(s, 'password', 0, maxN=1024, maxrp=8, maxbytes=128*4*1024), 'message')
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', maxN=512))
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', maxrp=7))
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', maxbytes=128*4*1024-1))
+        # ceilings left out fall back to the time and memory limits
+        ceil = dict(maxN=1024, maxrp=8, maxbytes=128*4*1024)
+        self.assertEqual(scrypt.decrypt(s, 'password', 1e-9, **ceil), 'message')
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'password', 1e-9, maxN=1024, maxbytes=2**30))
+        s2 = scrypt.encrypt('message', 'password', N=2**14, r=1, p=1)
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s2, 'password', maxmem=2**20, maxN=2**14, maxrp=1))
+        # a header asking for r * p = 2**29 is refused, not computed
+        header = b'scrypt\x00' + struct.pack('>BII', 10, 2**15, 2**14) + b'\x00' * 32
+        header += hashlib.sha256(header).digest()[:16] + b'\x00' * 32
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(header + b'\x00' * 32, 'password', maxN=1024))
+        # so is one with r = 0 or p = 0, which would divide by zero
+        for r, p in ((0, 1), (1, 0)):
+            header = b'scrypt\x00' + struct.pack('>BII', 10, r, p) + b'\x00' * 32
+            header += hashlib.sha256(header).digest()[:16] + b'\x00' * 32
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(header + b'\x00' * 32, 'password', maxN=1 << 20))
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt(header + b'\x00' * 32, 'password'))
+        # every other way of decrypting takes them too
+        s = scrypt.encrypt(b'message', 'password', N=1024, r=4, p=2, segmented=True)
+        self.assertEqual(scrypt.decrypt_range(s, 'password', 1, 3, 1e-9, **ceil), b'ess')
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt_range(s, 'password', 1, 3, maxN=512))
+        f = tempfile.TemporaryFile()
+        try:
+            f.write(s)
+            f.flush()
+            self.assertEqual(scrypt.decrypt_stream_range(f, 'password', 1, 3, 1e-9, **ceil), b'ess')
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream_range(f, 'password', 1, 3, maxrp=7))
+            out = tempfile.TemporaryFile()
+            f.seek(0)
+            scrypt.decrypt_stream(f, out, 'password', 1e-9, **ceil)
+            out.seek(0)
+            self.assertEqual(out.read(), b'message')
+            f.seek(0)
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt_stream(f, out, 'password', spool=0, maxN=512))
+            out.close()
+        finally:
+            f.close()
+        d = tempfile.mkdtemp()
+        try:
+            enc, dec = os.path.join(d, 'enc'), os.path.join(d, 'dec')
+            with open(enc, 'wb') as f:
+                f.write(s)
+            scrypt.decrypt_file(enc, dec, 'password', 1e-9, **ceil)
+            with open(dec, 'rb') as f:
+                self.assertEqual(f.read(), b'message')
+            self.assertRaises(scrypt.error, lambda: scrypt.decrypt_file(enc, dec, 'password', maxbytes=1024))
+        finally:
+            shutil.rmtree(d)
+        s = scrypt.encrypt(b'message', 'password', N=1024, r=4, p=2)
+        dec = scrypt.Decryptor('password', 1e-9, **ceil)
+        self.assertEqual(dec.update(s), b'message')
+        dec.finalize()
+        self.assertRaises(scrypt.error, lambda: scrypt.Decryptor('password', maxN=512).update(s))
+        sess = scrypt.Session('password', N=1024, r=4, p=2)
+        record = sess.encrypt(b'message')
+        self.assertEqual(scrypt.Session('password', sess.header, 1e-9, **ceil).decrypt(record), b'message')
+        self.assertRaises(scrypt.error, lambda: scrypt.Session('password', sess.header, maxrp=7))
+        self.assertRaises(ValueError, lambda: scrypt.Session('password', **ceil))
+
+    def test_stats(self):
+        scrypt.enable_stats(True)
+        try:
+            scrypt.reset_stats()
+            s = scrypt.encrypt('message', 'password', N=1024, r=4, p=2)
+            last = scrypt.last_stats()
+            self.assertEqual(last['smix_fill']['calls'], 2)
+            self.assertEqual(last['smix_mix']['bytes'], 2*128*4*1024)
+            self.assertEqual(last['calibrate']['calls'], 0)
+            self.assertEqual(last['aesctr']['bytes'], len('message'))
+            self.assertTrue(last['hmac']['calls'] > 0)
+            scrypt.decrypt(s, 'password', maxN=1024)
+            self.assertEqual(scrypt.last_stats()['alloc']['calls'], 1)
+            self.assertEqual(scrypt.stats()['alloc']['calls'], 2)
+            scrypt.reset_stats()
+            self.assertEqual(scrypt.stats()['alloc']['calls'], 0)
+            # touching 16 MiB of fresh memory takes page faults
+            scrypt.hash('password', 'salt', N=2**14, r=8, p=1)
+            if sys.platform.startswith('linux'):
+                self.assertTrue(scrypt.last_stats()['minflt'] > 0)
+        finally:
+            scrypt.enable_stats(False)
+        scrypt.hash('password', 'salt', N=16, r=1, p=1)
+        self.assertEqual(scrypt.last_stats()['alloc']['calls'], 0)
+
+    def test_metrics(self):
+        before = scrypt.metrics()
+        s = scrypt.encrypt('message', 'password', N=2048, r=3, p=1)
+        self.assertRaises(scrypt.error, lambda: scrypt.decrypt(s, 'wrong password', maxN=2048))
+        after = scrypt.metrics()
+        def calls(m, api, outcome):
+            return m['calls'].get(api, {}).get(outcome, 0)
+        self.assertEqual(calls(after, 'encrypt', 'success'), calls(before, 'encrypt', 'success') + 1)
+        self.assertEqual(calls(after, 'decrypt', 'password'), calls(before, 'decrypt', 'password') + 1)
+        self.assertEqual(after['bytes_encrypted'], before['bytes_encrypted'] + len('message'))
+        self.assertEqual(after['v_memory_bytes'], 0)
+        def kdf(m, key):
+            ks = dict(((k['N'], k['r'], k['p']), k) for k in m['kdf_seconds'])
+            return ks.get(key, {'count': 0})
+        key = (2048, 3, 1)
+        if kdf(after, key)['count'] == 0:
+            # only once all 32 histograms were taken by other parameters
+            # (see test_differential) do these share the one for the rest
+            self.assertEqual(len([k for k in before['kdf_seconds'] if k['N'] is not None]), 32)
+            key = (None, None, None)
+        self.assertEqual(kdf(after, key)['count'], kdf(before, key)['count'] + 2)
+        self.assertEqual(kdf(after, key)['buckets'][-1], (float('inf'), kdf(after, key)['count']))
+        # bad hash parameters count as invalid, not as a failed key derivation
+        before = scrypt.metrics()
+        self.assertRaises(scrypt.error, lambda: scrypt.hash('password', 'salt', N=16, r=1, p=0))
+        self.assertRaises(scrypt.error, lambda: scrypt.verify('password', 'salt', b'x', N=15))
+        after = scrypt.metrics()
+        for api in ('hash', 'verify'):
+            self.assertEqual(calls(after, api, 'invalid'), calls(before, api, 'invalid') + 1)
+            self.assertEqual(calls(after, api, 'kdf'), calls(before, api, 'kdf'))
+
+    def test_verify(self):
+        h = scrypt.hash('password', 'salt', N=16, r=1, p=1)
+        self.assertTrue(scrypt.verify('password', 'salt', h, N=16, r=1, p=1))
+        self.assertTrue(scrypt.verify('password', 'salt', h[:32], N=16, r=1, p=1))
+        self.assertFalse(scrypt.verify('wrong password', 'salt', h, N=16, r=1, p=1))
+        self.assertFalse(scrypt.verify('password', 'pepper', h, N=16, r=1, p=1))
+        # bad parameters raise instead of crashing
+        for N, r, p in ((16, 1, 0), (16, 0, 1), (16, 2**16, 2**16), (15, 1, 1)):
+            self.assertRaises(scrypt.error, lambda: scrypt.verify('password', 'salt', h, N=N, r=r, p=p))
         
+    def test_random_salt(self):
+        self.assertEqual(len(scrypt.random_salt()), 32)
+        self.assertEqual(len(scrypt.random_salt(100000)), 100000)
+        self.assertNotEqual(scrypt.random_salt(16), scrypt.random_salt(16))
+        scrypt.set_salt_pool(True)
+        try:
+            salts = set(scrypt.random_salt(16) for i in range(1000))
+            self.assertEqual(len(salts), 1000)
+            s = scrypt.encrypt('message', 'password', .1)
+            self.assertEqual(scrypt.decrypt(s, 'password', 5), 'message')
+        finally:
+            scrypt.set_salt_pool(False)
+
+    def test_mcf(self):
+        mcf = scrypt.mcf_hash('password', N=16, r=1, p=1)
+        self.assertTrue(mcf.startswith('$7$'))
+        self.assertTrue(scrypt.mcf_verify('password', mcf))
+        self.assertFalse(scrypt.mcf_verify('wrong password', mcf))
+        self.assertNotEqual(mcf, scrypt.mcf_hash('password', N=16, r=1, p=1))
+        self.assertRaises(scrypt.error, lambda: scrypt.mcf_verify('password', mcf[:-1]))
+        # known answer from libxcrypt, for N = 2**14, r = 8, p = 1
+        vector = '$7$C6..../....SodiumChloride$kBGj9fHznVYFQMEn/qDCfrDevf9YDtcDdKvEqHJLV8D'
+        self.assertTrue(scrypt.mcf_verify('pleaseletmein', vector))
+        self.assertFalse(scrypt.mcf_verify('pleaseletmeim', vector))
+        for N, r, p in ((16, 1, 0), (16, 2**16, 2**16), (15, 1, 1)):
+            self.assertRaises(scrypt.error, lambda: scrypt.mcf_hash('password', N=N, r=r, p=p))
+
+    def test_needs_rehash(self):
+        mcf = scrypt.mcf_hash('password', N=16, r=1, p=1)
+        self.assertFalse(scrypt.needs_rehash(mcf, N=16, r=1, p=1))
+        self.assertTrue(scrypt.needs_rehash(mcf, N=32, r=1, p=1))
+        self.assertTrue(scrypt.needs_rehash(mcf, N=16, r=8, p=1))
+
 if __name__ == '__main__':
     unittest.main()